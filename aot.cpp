@@ -0,0 +1,257 @@
+/*
+Ahead-of-time recompiler for Chip 8 ROMs: recovers the control-flow graph of a ROM from
+PROGRAM_START_ADDRESS and emits a C++ translation unit with one function per basic block,
+to be linked with aot_runner.cpp
+*/
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "instruction.h"
+
+// Escapes text for a C++ string literal. The result has no line breaks, so in quotes it can
+// also go into a // comment without a trailing backslash continuing the line
+static std::string escapeString(const std::string &text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char) c < 0x20 || (unsigned char) c >= 0x7F) {
+            // Octal escapes stop after three digits, unlike hexadecimal ones
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\%03o", (unsigned char) c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Instructions after which execution doesn't simply continue with the next instruction
+static bool endsBlock(Op op) {
+    switch (op) {
+        case Op::Jump:
+        case Op::Call:
+        case Op::Return:
+        case Op::JumpOffset:
+        case Op::SkipEqualImm:
+        case Op::SkipNotEqualImm:
+        case Op::SkipEqualReg:
+        case Op::SkipNotEqualReg:
+        case Op::SkipKeyPressed:
+        case Op::SkipKeyNotPressed:
+        case Op::WaitKey:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions that write memory; the block ends after them, so the runtime checks the
+// code of the next block against the ROM before running it
+static bool writesMemory(Op op) {
+    return op == Op::StoreBCD || op == Op::StoreRegisters;
+}
+
+// Emits C++ for one instruction; returns false if it has to run in the interpreter
+static bool emitInstruction(FILE *out, const Instruction &in, unsigned short address, const QuirkFlags &quirks) {
+    unsigned short next = address + 2;
+    const char *resetVF = quirks.logicResetsVF ? " V[0xF] = 0;" : "";
+    int shiftSource = quirks.shiftUsesVy ? in.y : in.x;
+    switch (in.op) {
+        case Op::Nop: break;
+        case Op::LoadImm: fprintf(out, "    V[0x%X] = 0x%02X;\n", in.x, in.kk); break;
+        case Op::AddImm: fprintf(out, "    V[0x%X] += 0x%02X;\n", in.x, in.kk); break;
+        case Op::Move: fprintf(out, "    V[0x%X] = V[0x%X];\n", in.x, in.y); break;
+        case Op::Or: fprintf(out, "    V[0x%X] |= V[0x%X];%s\n", in.x, in.y, resetVF); break;
+        case Op::And: fprintf(out, "    V[0x%X] &= V[0x%X];%s\n", in.x, in.y, resetVF); break;
+        case Op::Xor: fprintf(out, "    V[0x%X] ^= V[0x%X];%s\n", in.x, in.y, resetVF); break;
+        case Op::AddReg:
+            fprintf(out, "    { unsigned short sum = V[0x%X] + V[0x%X]; V[0x%X] = sum & 0xFF; V[0xF] = sum > 0xFF; }\n",
+                    in.x, in.y, in.x);
+            break;
+        case Op::SubReg:
+        case Op::SubReverse: {
+            int a = in.op == Op::SubReg ? in.x : in.y;
+            int b = in.op == Op::SubReg ? in.y : in.x;
+            fprintf(out, "    { short difference = V[0x%X] - V[0x%X]; V[0x%X] = (unsigned char) difference; V[0xF] = difference > 0; }\n",
+                    a, b, in.x);
+            break;
+        }
+        case Op::ShiftRight:
+            fprintf(out, "    { unsigned char value = V[0x%X]; V[0x%X] = value >> 1; V[0xF] = value & 0x01; }\n", shiftSource, in.x);
+            break;
+        case Op::ShiftLeft:
+            fprintf(out, "    { unsigned char value = V[0x%X]; V[0x%X] = value << 1; V[0xF] = (value & 0x80) >> 7; }\n", shiftSource, in.x);
+            break;
+        case Op::LoadIndex: fprintf(out, "    I = 0x%03X;\n", in.nnn); break;
+        case Op::AddIndex: fprintf(out, "    I += V[0x%X];\n", in.x); break;
+        case Op::LoadDelay: fprintf(out, "    V[0x%X] = (unsigned char) DT;\n", in.x); break;
+        case Op::SetDelay: fprintf(out, "    DT = V[0x%X];\n", in.x); break;
+        case Op::SetSound: fprintf(out, "    ST = V[0x%X];\n", in.x); break;
+        case Op::Jump: fprintf(out, "    PC = 0x%03X;\n", in.nnn); break;
+        case Op::JumpOffset: fprintf(out, "    PC = V[0x%X] + 0x%03X;\n", quirks.jumpUsesVx ? in.x : 0, in.nnn); break;
+        case Op::Call:
+            fprintf(out, "    S[SP & 0xF] = 0x%03X; SP = (SP + 1) & 0xF; PC = 0x%03X;\n", next, in.nnn);
+            break;
+        case Op::Return: fprintf(out, "    SP = (SP - 1) & 0xF; PC = S[SP];\n"); break;
+        case Op::SkipEqualImm: fprintf(out, "    PC = V[0x%X] == 0x%02X ? 0x%03X : 0x%03X;\n", in.x, in.kk, next + 2, next); break;
+        case Op::SkipNotEqualImm: fprintf(out, "    PC = V[0x%X] != 0x%02X ? 0x%03X : 0x%03X;\n", in.x, in.kk, next + 2, next); break;
+        case Op::SkipEqualReg: fprintf(out, "    PC = V[0x%X] == V[0x%X] ? 0x%03X : 0x%03X;\n", in.x, in.y, next + 2, next); break;
+        case Op::SkipNotEqualReg: fprintf(out, "    PC = V[0x%X] != V[0x%X] ? 0x%03X : 0x%03X;\n", in.x, in.y, next + 2, next); break;
+        default:
+            fprintf(out, "    AotRuntime::interpret(c, 0x%03X);\n", address);
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    try {
+        if (argc != 3 && argc != 4) {
+            throw std::invalid_argument("Usage: chip8-aot <rom-file> <output.cpp> [modern|chip8|chip48|schip]");
+        }
+        Variant variant = Variant::Modern;
+        if (argc == 4 && !parseVariant(argv[3], variant)) {
+            throw std::invalid_argument(std::string("Unknown variant ") + argv[3]);
+        }
+        const QuirkFlags quirks = getQuirkFlags(variant);
+
+        // Same limits as Chip8::loadGame(), so the generated program always loads
+        std::vector<unsigned char> rom = Chip8::readRom(argv[1]);
+        if (rom.empty()) {
+            throw Chip8::InitializationError("ROM is empty");
+        }
+        size_t programSpace = quirks.programEnd - PROGRAM_START_ADDRESS;
+        if (rom.size() > programSpace) {
+            throw Chip8::InitializationError("ROM is " + std::to_string(rom.size()) + " bytes; " +
+                                             getVariantName(variant) + " programs can be at most " +
+                                             std::to_string(programSpace));
+        }
+        std::string romName = escapeString(argv[1]);
+
+        const int romEnd = PROGRAM_START_ADDRESS + rom.size();
+        auto decodeAt = [&](int address) {
+            int offset = address - PROGRAM_START_ADDRESS;
+            return decodeInstruction(rom[offset] << 8 | rom[offset + 1]);
+        };
+
+        // Recover the control-flow graph: every instruction reachable from the entry point,
+        // and the addresses that start a basic block. Targets of 0xBnnn and 0x00EE are only
+        // known at run time; those fall back to the interpreter unless they land on a leader.
+        std::vector<bool> reachable(4096 + 2, false);
+        std::vector<bool> leader(4096 + 2, false);
+        std::vector<int> worklist = { PROGRAM_START_ADDRESS };
+        leader[PROGRAM_START_ADDRESS] = true;
+        while (!worklist.empty()) {
+            int address = worklist.back();
+            worklist.pop_back();
+            if (address < PROGRAM_START_ADDRESS || address + 1 >= romEnd || reachable[address]) {
+                continue;
+            }
+            reachable[address] = true;
+
+            Instruction in = decodeAt(address);
+            int next = address + 2;
+            std::vector<int> successors;
+            switch (in.op) {
+                case Op::Jump: successors = { in.nnn }; break;
+                case Op::Call: successors = { in.nnn, next }; break;
+                case Op::Return:
+                case Op::JumpOffset: break;
+                default:
+                    if (endsBlock(in.op)) {
+                        successors = { next, next + 2 }; // Skips and 0xFx0A
+                    }
+                    else {
+                        worklist.push_back(next);
+                        if (writesMemory(in.op)) {
+                            leader[next & 0xFFF] = true;
+                        }
+                    }
+                    break;
+            }
+            for (int successor : successors) {
+                leader[successor & 0xFFF] = true;
+                worklist.push_back(successor);
+            }
+        }
+
+        FILE *out = fopen(argv[2], "w");
+        if (out == nullptr) {
+            throw std::runtime_error(std::string("Unable to write ") + argv[2]);
+        }
+
+        fprintf(out, "// Generated by chip8-aot from \"%s\" for the %s variant; do not edit\n", romName.c_str(), getVariantName(variant));
+        fprintf(out, "#include \"aot_runtime.h\"\n\n");
+        fprintf(out, "#define V AotRuntime::registers(c)\n");
+        fprintf(out, "#define S AotRuntime::stack(c)\n");
+        fprintf(out, "#define I AotRuntime::index(c)\n");
+        fprintf(out, "#define PC AotRuntime::programCounter(c)\n");
+        fprintf(out, "#define SP AotRuntime::stackPointer(c)\n");
+        fprintf(out, "#define DT AotRuntime::delayTimer(c)\n");
+        fprintf(out, "#define ST AotRuntime::soundTimer(c)\n\n");
+
+        fprintf(out, "static const unsigned char rom[] = {");
+        for (size_t i = 0; i < rom.size(); i++) {
+            fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", rom[i]);
+        }
+        fprintf(out, "\n};\n\n");
+
+        // Blocks run from a leader up to the next leader or the first instruction that ends a block
+        struct BlockInfo { int start; int end; int length; };
+        std::vector<BlockInfo> blocks;
+        for (int start = PROGRAM_START_ADDRESS; start < romEnd; start++) {
+            if (!leader[start] || !reachable[start]) {
+                continue;
+            }
+
+            fprintf(out, "static void block_%03X(Chip8 &c) {\n", start);
+            int address = start;
+            int length = 0;
+            bool terminated = false;
+            while (!terminated) {
+                Instruction in = decodeAt(address);
+                bool compiled = emitInstruction(out, in, address, quirks);
+                address += 2;
+                length++;
+                terminated = endsBlock(in.op);
+                if (terminated && !compiled) {
+                    // The interpreter already moved the program counter
+                    break;
+                }
+                if (!terminated && (leader[address] || !reachable[address])) {
+                    fprintf(out, "    PC = 0x%03X;\n", address);
+                    break;
+                }
+            }
+            fprintf(out, "}\n\n");
+            blocks.push_back({ start, address, length });
+        }
+
+        // Terminated by an empty entry so the array is never zero-sized
+        fprintf(out, "static const AotRuntime::Block blocks[] = {\n");
+        for (const BlockInfo &block : blocks) {
+            fprintf(out, "    { 0x%03X, 0x%03X, %d, block_%03X },\n", block.start, block.end, block.length, block.start);
+        }
+        fprintf(out, "    { 0, 0, 0, nullptr },\n");
+        fprintf(out, "};\n\n");
+        fprintf(out, "extern const AotRuntime::Program aotProgram = {\n");
+        fprintf(out, "    \"%s\", (Variant) %d, rom, (int) sizeof(rom), blocks, %d\n", romName.c_str(), (int) variant, (int) blocks.size());
+        fprintf(out, "};\n");
+
+        fclose(out);
+        std::cout << "Compiled " << blocks.size() << " blocks from " << argv[1] << std::endl;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+/*
+Headless runner for a ROM recompiled ahead of time by chip8-aot; runs the program for the
+given number of cycles and prints the final screen
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "aot_runtime.h"
+
+#define AOT_CLOCK_SPEED 500 // Emulated clock speed in Hertz; sets how often the 60 Hz timers tick
+
+extern const AotRuntime::Program aotProgram;
+
+int main(int argc, char **argv) {
+    long long cycles = argc > 1 ? atoll(argv[1]) : 1000000;
+
+    Chip8 chip8;
+    AotRuntime runtime(aotProgram);
+    runtime.load(chip8);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    // Run up to each 60 Hz timer tick, then update the timers
+    long long cyclesRun = 0;
+    for (long long tick = 1; cyclesRun < cycles; tick++) {
+        long long target = tick * AOT_CLOCK_SPEED / 60;
+        if (target > cycles) {
+            target = cycles;
+        }
+        runtime.run(chip8, (int) (target - cyclesRun));
+        cyclesRun = target;
+        chip8.updateTimers();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            putchar(chip8.getDisplay(y * SCREEN_WIDTH + x) ? '#' : '.');
+        }
+        putchar('\n');
+    }
+    std::cout << aotProgram.name << ": " << cycles << " cycles in " << seconds << " s ("
+              << cycles / seconds / 1e6 << " MIPS)" << std::endl;
+
+    return EXIT_SUCCESS;
+}
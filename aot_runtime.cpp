@@ -0,0 +1,44 @@
+#include <cstring>
+#include "aot_runtime.h"
+
+AotRuntime::AotRuntime(const Program &program) : program(program) {
+    for (int i = 0; i < program.blockCount; i++) {
+        blockAt[program.blocks[i].start] = &program.blocks[i];
+    }
+}
+
+void AotRuntime::load(Chip8 &chip8) {
+    chip8.loadGame(program.rom, program.romSize, program.variant);
+}
+
+bool AotRuntime::isUnmodified(Chip8 &chip8, const Block &block) {
+    if (verified[block.start] && verifiedAt[block.start] == chip8.memoryWrites) {
+        return true;
+    }
+    verified[block.start] = memcmp(chip8.state.memory + block.start, program.rom + (block.start - PROGRAM_START_ADDRESS),
+                                   block.end - block.start) == 0;
+    verifiedAt[block.start] = chip8.memoryWrites;
+    return verified[block.start];
+}
+
+void AotRuntime::run(Chip8 &chip8, int cycles) {
+    int remaining = cycles;
+    while (remaining > 0 && !chip8.state.pausedForKeyPress) {
+        const Block *block = chip8.state.programCounter < 4096 ? blockAt[chip8.state.programCounter] : nullptr;
+
+        // Self-modified code no longer matches what was compiled; interpret it instead
+        if (block != nullptr && block->length <= remaining && isUnmodified(chip8, *block)) {
+            block->run(chip8);
+            remaining -= block->length;
+        }
+        else {
+            chip8.step();
+            remaining--;
+        }
+    }
+}
+
+void AotRuntime::interpret(Chip8 &chip8, unsigned short address) {
+    chip8.state.programCounter = address;
+    chip8.step();
+}
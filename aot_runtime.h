@@ -0,0 +1,82 @@
+/*
+Runtime for ROMs recompiled ahead of time by chip8-aot
+*/
+
+#ifndef AOT_RUNTIME_H_INCLUDED
+#define AOT_RUNTIME_H_INCLUDED
+
+#include "chip8.h"
+
+class AotRuntime {
+public:
+    // Straight-line run of CHIP-8 instructions compiled into a C++ function; every block
+    // executes exactly length instructions and leaves the program counter at the next one.
+    // A block ends after any instruction that writes memory, so code is only checked for
+    // self-modification at block entry
+    struct Block {
+        unsigned short start;   // Address of the first instruction
+        unsigned short end;     // Address just past the last instruction
+        int length;
+        void (*run)(Chip8 &chip8);
+    };
+
+    // Everything chip8-aot emits for one ROM
+    struct Program {
+        const char *name;
+        Variant variant;    // Quirks the blocks were compiled with
+        const unsigned char *rom;
+        int romSize;
+        const Block *blocks;
+        int blockCount;
+    };
+
+private:
+    const Program &program;
+    // Block starting at each address, or null where the interpreter has to run
+    const Block *blockAt[4096] = {};
+    // Chip8::memoryWrites when each block's code was last found unchanged; the ROM bytes are
+    // only compared again after memory has been written
+    unsigned int verifiedAt[4096] = {};
+    bool verified[4096] = {};
+
+    /*
+    Check if memory still holds the ROM bytes the block was compiled from
+    */
+    bool isUnmodified(Chip8 &chip8, const Block &block);
+
+public:
+    /*
+    Indexes the blocks of a recompiled program
+    */
+    AotRuntime(const Program &program);
+
+    /*
+    Loads the program's ROM with Chip8::loadGame() for the variant it was compiled for
+    */
+    void load(Chip8 &chip8);
+
+    /*
+    Runs up to cycles instructions, calling compiled blocks where they fit in the remaining
+    budget and the ROM bytes they were compiled from are unchanged, interpreting otherwise
+    */
+    void run(Chip8 &chip8, int cycles);
+
+    /*
+    Accessors used by generated code
+    */
+    static unsigned char *registers(Chip8 &chip8) { return chip8.state.registers; }
+    static unsigned short *stack(Chip8 &chip8) { return chip8.state.stack; }
+    static unsigned short &index(Chip8 &chip8) { return chip8.state.index; }
+    static unsigned short &programCounter(Chip8 &chip8) { return chip8.state.programCounter; }
+    static unsigned char &stackPointer(Chip8 &chip8) { return chip8.state.stackPointer; }
+    static unsigned short &delayTimer(Chip8 &chip8) { return chip8.state.delayTimer; }
+    static unsigned short &soundTimer(Chip8 &chip8) { return chip8.state.soundTimer; }
+
+    /*
+    Executes the instruction at address with the interpreter; used by generated code for
+    instructions that aren't worth compiling (drawing, input, memory access, ...)
+    */
+    static void interpret(Chip8 &chip8, unsigned short address);
+};
+
+#endif
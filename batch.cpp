@@ -0,0 +1,432 @@
+#include <algorithm>
+#include "batch.h"
+
+#if BATCH_AVX2_SUPPORTED
+#include <immintrin.h>
+#endif
+
+// Operations that only touch V0-VF, I and the program counter, so they can run on many lanes
+// at once without going through each lane's Chip8
+static bool isLaneParallel(Op op) {
+    switch (op) {
+        case Op::Nop:
+        case Op::Jump:
+        case Op::SkipEqualImm:
+        case Op::SkipNotEqualImm:
+        case Op::SkipEqualReg:
+        case Op::LoadImm:
+        case Op::AddImm:
+        case Op::Move:
+        case Op::Or:
+        case Op::And:
+        case Op::Xor:
+        case Op::AddReg:
+        case Op::SubReg:
+        case Op::ShiftRight:
+        case Op::SubReverse:
+        case Op::ShiftLeft:
+        case Op::SkipNotEqualReg:
+        case Op::LoadIndex:
+        case Op::JumpOffset:
+        case Op::AddIndex:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Batch::Batch(int laneCount, Variant variant) : variant(variant), quirks(getQuirkFlags(variant)) {
+    stride = (laneCount + BATCH_LANE_ALIGNMENT - 1) / BATCH_LANE_ALIGNMENT * BATCH_LANE_ALIGNMENT;
+    for (int i = 0; i < laneCount; i++) {
+        lanes.emplace_back(new Chip8());
+        lanes.back()->setVariant(variant);
+    }
+    registers.resize(16 * stride);
+    index.resize(stride);
+    programCounter.resize(stride);
+    groupMask.resize(stride);
+    laneMask.resize(stride);
+    std::fill(laneMask.begin(), laneMask.begin() + laneCount, 0xFF);
+    waiting.resize(stride);
+    nextInGroup.resize(stride);
+    memoryWritesSeen.resize(laneCount);
+    checkedOut.resize(laneCount, 1);
+    // Until a game is loaded the lanes' memory is unknown
+    std::fill(std::begin(written), std::end(written), true);
+#if BATCH_AVX2_SUPPORTED
+    useAvx2 = __builtin_cpu_supports("avx2");
+#else
+    useAvx2 = false;
+#endif
+}
+
+Batch::~Batch() {}
+
+void Batch::loadGame(std::string fileName) {
+    std::vector<unsigned char> rom = Chip8::readRom(fileName);
+    loadGame(rom.data(), rom.size());
+}
+
+void Batch::loadGame(const unsigned char *data, size_t size) {
+    for (int lane = 0; lane < (int) lanes.size(); lane++) {
+        getLane(lane).loadGame(data, size, variant);
+        memoryWritesSeen[lane] = lanes[lane]->memoryWrites;
+    }
+    std::fill(std::begin(written), std::end(written), false);
+}
+
+void Batch::gather(int lane) {
+    const Chip8State &state = lanes[lane]->state;
+    for (int r = 0; r < 16; r++) {
+        registers[r * stride + lane] = state.registers[r];
+    }
+    index[lane] = state.index;
+    programCounter[lane] = state.programCounter;
+    waitingLanes += state.pausedForKeyPress - waiting[lane];
+    waiting[lane] = state.pausedForKeyPress;
+}
+
+void Batch::scatter(int lane) {
+    Chip8State &state = lanes[lane]->state;
+    for (int r = 0; r < 16; r++) {
+        state.registers[r] = registers[r * stride + lane];
+    }
+    state.index = index[lane];
+    state.programCounter = programCounter[lane];
+}
+
+unsigned short Batch::fetchOpcode(int lane) {
+    const unsigned char *memory = lanes[lane]->state.memory;
+    unsigned short pc = programCounter[lane];
+    return memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+}
+
+void Batch::runCycles(int cycles) {
+    // Take back the lanes handed out by getLane(), which may have been changed in any way
+    for (int lane = 0; lane < (int) lanes.size(); lane++) {
+        if (checkedOut[lane]) {
+            gather(lane);
+            checkedOut[lane] = 0;
+            // Memory written outside runCycles(), e.g. by loadState(), may hold different
+            // code in each lane anywhere
+            if (lanes[lane]->memoryWrites != memoryWritesSeen[lane]) {
+                std::fill(std::begin(written), std::end(written), true);
+            }
+        }
+    }
+    for (int i = 0; i < cycles; i++) {
+        cycle();
+    }
+}
+
+void Batch::setKeyMask(int lane, unsigned short mask) {
+    // Releasing a key during 0xFx0A writes a register, so a waiting lane needs its registers
+    if (!checkedOut[lane] && waiting[lane]) {
+        scatter(lane);
+        lanes[lane]->setKeyMask(mask);
+        gather(lane);
+    }
+    else {
+        lanes[lane]->setKeyMask(mask);
+    }
+}
+
+void Batch::updateTimers() {
+    for (std::unique_ptr<Chip8> &lane : lanes) {
+        lane->updateTimers();
+    }
+}
+
+bool Batch::isCodeShared(unsigned short pc) {
+    return !written[pc & 0xFFF] && !written[(pc + 1) & 0xFFF];
+}
+
+void Batch::cycle() {
+    const int laneCount = lanes.size();
+
+    // Fast path: every lane at the same address, which no lane has written
+    unsigned short pc = programCounter[0];
+    bool converged = waitingLanes == 0 && isCodeShared(pc);
+    for (int lane = 1; lane < laneCount && converged; lane++) {
+        converged = programCounter[lane] == pc;
+    }
+    if (converged) {
+        if (!executeGroup(decodeInstruction(fetchOpcode(0)), laneMask.data())) {
+            for (int lane = 0; lane < laneCount; lane++) {
+                executeLane(lane);
+            }
+        }
+        return;
+    }
+
+    // Bucket the lanes by address, keeping each bucket in lane order
+    stamp++;
+    leaders.clear();
+    for (int lane = 0; lane < laneCount; lane++) {
+        if (waiting[lane]) {
+            continue; // emulateCycle() does nothing until a key is released
+        }
+        int address = programCounter[lane] & 0xFFF;
+        nextInGroup[lane] = -1;
+        if (groupStamp[address] != stamp) {
+            groupStamp[address] = stamp;
+            groupTail[address] = lane;
+            leaders.push_back(lane);
+        }
+        else {
+            nextInGroup[groupTail[address]] = lane;
+            groupTail[address] = lane;
+        }
+    }
+
+    for (int leader : leaders) {
+        // Only lanes with the same program counter and code can share an instruction; the
+        // code only has to be compared where some lane may have modified it
+        pc = programCounter[leader];
+        unsigned short opcode = fetchOpcode(leader);
+        bool shared = isCodeShared(pc);
+        int members = 0;
+        for (int lane = leader; lane != -1; lane = nextInGroup[lane]) {
+            if (programCounter[lane] == pc && (shared || fetchOpcode(lane) == opcode)) {
+                groupMask[lane] = 0xFF;
+                members++;
+            }
+        }
+
+        bool executed = members >= BATCH_MIN_GROUP_SIZE && executeGroup(decodeInstruction(opcode), groupMask.data());
+        for (int lane = leader; lane != -1; lane = nextInGroup[lane]) {
+            if (!executed || !groupMask[lane]) {
+                executeLane(lane);
+            }
+            groupMask[lane] = 0;
+        }
+    }
+}
+
+bool Batch::executeGroup(const Instruction &in, const unsigned char *mask) {
+    if (!isLaneParallel(in.op)) {
+        return false;
+    }
+#if BATCH_AVX2_SUPPORTED
+    if (useAvx2) {
+        executeGroupAvx2(in, mask);
+        return true;
+    }
+#endif
+    for (int lane = 0; lane < stride; lane++) {
+        if (mask[lane]) {
+            executeLaneParallel(lane, in);
+        }
+    }
+    return true;
+}
+
+void Batch::executeLane(int lane) {
+    Chip8 &chip8 = *lanes[lane];
+    unsigned short pc = programCounter[lane];
+    Instruction &in = chip8.decodeCache[pc & 0xFFF];
+    if (in.op == Op::Undecoded) {
+        in = decodeInstruction(fetchOpcode(lane));
+    }
+
+    if (isLaneParallel(in.op)) {
+        executeLaneParallel(lane, in);
+        return;
+    }
+
+    // The only instructions that write memory store at I onwards
+    if (in.op == Op::StoreBCD || in.op == Op::StoreRegisters) {
+        int length = in.op == Op::StoreBCD ? 3 : in.x + 1;
+        for (int i = 0; i < length; i++) {
+            written[(index[lane] + i) & 0xFFF] = true;
+        }
+    }
+    // Copy just the registers the instruction can use to the lane and back: Vx, Vy, VF,
+    // V0-Vx for 0xFx55/0xFx65, I and the program counter
+    Chip8State &state = chip8.state;
+    int last = in.op == Op::StoreRegisters || in.op == Op::LoadRegisters ? in.x : 0;
+    for (int r = 0; r <= last; r++) {
+        state.registers[r] = registers[r * stride + lane];
+    }
+    state.registers[in.x] = registers[in.x * stride + lane];
+    state.registers[in.y] = registers[in.y * stride + lane];
+    state.registers[0xF] = registers[0xF * stride + lane];
+    state.index = index[lane];
+    state.programCounter = pc;
+
+    chip8.emulateCycle();
+
+    for (int r = 0; r <= last; r++) {
+        registers[r * stride + lane] = state.registers[r];
+    }
+    registers[in.x * stride + lane] = state.registers[in.x];
+    registers[in.y * stride + lane] = state.registers[in.y];
+    registers[0xF * stride + lane] = state.registers[0xF];
+    index[lane] = state.index;
+    programCounter[lane] = state.programCounter;
+    if (state.pausedForKeyPress) {
+        waiting[lane] = 1;
+        waitingLanes++;
+    }
+}
+
+void Batch::executeLaneParallel(int lane, const Instruction &in) {
+    unsigned char *v = &registers[lane];
+    unsigned char x = v[in.x * stride], y = v[in.y * stride];
+    unsigned char shifted = quirks.shiftUsesVy ? y : x;
+    unsigned short pc = programCounter[lane] + 2;
+    switch (in.op) {
+        case Op::Jump: pc = in.nnn; break;
+        case Op::SkipEqualImm: pc += x == in.kk ? 2 : 0; break;
+        case Op::SkipNotEqualImm: pc += x != in.kk ? 2 : 0; break;
+        case Op::SkipEqualReg: pc += x == y ? 2 : 0; break;
+        case Op::SkipNotEqualReg: pc += x != y ? 2 : 0; break;
+        case Op::LoadImm: v[in.x * stride] = in.kk; break;
+        case Op::AddImm: v[in.x * stride] = x + in.kk; break;
+        case Op::Move: v[in.x * stride] = y; break;
+        case Op::Or: v[in.x * stride] = x | y; if (quirks.logicResetsVF) { v[0xF * stride] = 0; } break;
+        case Op::And: v[in.x * stride] = x & y; if (quirks.logicResetsVF) { v[0xF * stride] = 0; } break;
+        case Op::Xor: v[in.x * stride] = x ^ y; if (quirks.logicResetsVF) { v[0xF * stride] = 0; } break;
+        case Op::AddReg: v[in.x * stride] = x + y; v[0xF * stride] = x + y > 0xFF; break;
+        case Op::SubReg: v[in.x * stride] = x - y; v[0xF * stride] = x > y; break;
+        case Op::SubReverse: v[in.x * stride] = y - x; v[0xF * stride] = y > x; break;
+        case Op::ShiftRight: v[in.x * stride] = shifted >> 1; v[0xF * stride] = shifted & 0x01; break;
+        case Op::ShiftLeft: v[in.x * stride] = shifted << 1; v[0xF * stride] = shifted >> 7; break;
+        case Op::LoadIndex: index[lane] = in.nnn; break;
+        case Op::AddIndex: index[lane] += x; break;
+        case Op::JumpOffset: pc = v[(quirks.jumpUsesVx ? in.x : 0) * stride] + in.nnn; break;
+        default: break;
+    }
+    programCounter[lane] = pc;
+}
+
+#if BATCH_AVX2_SUPPORTED
+// Processes 32 lanes per iteration: byte registers take one vector, I and the program counter
+// two. Lanes outside the group keep their old values through blends
+__attribute__((target("avx2")))
+void Batch::executeGroupAvx2(const Instruction &in, const unsigned char *members) {
+    unsigned char *vxs = &registers[in.x * stride];
+    unsigned char *vys = &registers[in.y * stride];
+    unsigned char *vfs = &registers[0xF * stride];
+    const unsigned char *jumpBases = &registers[(quirks.jumpUsesVx ? in.x : 0) * stride];
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8(-1);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i kk = _mm256_set1_epi8((char) in.kk);
+
+    for (int base = 0; base < stride; base += 32) {
+        __m256i mask = _mm256_loadu_si256((const __m256i *) &members[base]);
+        if (_mm256_testz_si256(mask, mask)) {
+            continue;
+        }
+        __m256i vx = _mm256_loadu_si256((const __m256i *) &vxs[base]);
+        __m256i vy = _mm256_loadu_si256((const __m256i *) &vys[base]);
+        __m256i shifted = quirks.shiftUsesVy ? vy : vx;
+        __m256i result = vx;
+        __m256i flag = zero;
+        __m256i skip = zero; // 0xFF in lanes that skip the next instruction
+        bool writesX = true;
+        bool writesFlag = false;
+
+        switch (in.op) {
+            case Op::LoadImm: result = kk; break;
+            case Op::AddImm: result = _mm256_add_epi8(vx, kk); break;
+            case Op::Move: result = vy; break;
+            case Op::Or: result = _mm256_or_si256(vx, vy); writesFlag = quirks.logicResetsVF; break;
+            case Op::And: result = _mm256_and_si256(vx, vy); writesFlag = quirks.logicResetsVF; break;
+            case Op::Xor: result = _mm256_xor_si256(vx, vy); writesFlag = quirks.logicResetsVF; break;
+            case Op::AddReg:
+                // Carry out iff the wrapped sum is below an operand, i.e. max(sum, Vx) != sum
+                result = _mm256_add_epi8(vx, vy);
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(result, vx), result), one);
+                writesFlag = true;
+                break;
+            case Op::SubReg:
+                // Vx > Vy iff max(Vx, Vy) != Vy
+                result = _mm256_sub_epi8(vx, vy);
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vy), one);
+                writesFlag = true;
+                break;
+            case Op::SubReverse:
+                result = _mm256_sub_epi8(vy, vx);
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vx), one);
+                writesFlag = true;
+                break;
+            case Op::ShiftRight:
+                // There is no byte shift; shift 16-bit words and drop the bit shifted in
+                result = _mm256_and_si256(_mm256_srli_epi16(shifted, 1), _mm256_set1_epi8(0x7F));
+                flag = _mm256_and_si256(shifted, one);
+                writesFlag = true;
+                break;
+            case Op::ShiftLeft:
+                result = _mm256_add_epi8(shifted, shifted);
+                flag = _mm256_and_si256(_mm256_srli_epi16(shifted, 7), one);
+                writesFlag = true;
+                break;
+            case Op::SkipEqualImm: skip = _mm256_cmpeq_epi8(vx, kk); writesX = false; break;
+            case Op::SkipNotEqualImm: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, kk), ones); writesX = false; break;
+            case Op::SkipEqualReg: skip = _mm256_cmpeq_epi8(vx, vy); writesX = false; break;
+            case Op::SkipNotEqualReg: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, vy), ones); writesX = false; break;
+            default: writesX = false; break;
+        }
+
+        // Vx first, then VF, so that VF ends up holding the flag when x is 0xF
+        if (writesX) {
+            _mm256_storeu_si256((__m256i *) &vxs[base], _mm256_blendv_epi8(vx, result, mask));
+        }
+        if (writesFlag) {
+            __m256i vf = _mm256_loadu_si256((const __m256i *) &vfs[base]);
+            _mm256_storeu_si256((__m256i *) &vfs[base], _mm256_blendv_epi8(vf, flag, mask));
+        }
+
+        __m256i jumpBase = _mm256_loadu_si256((const __m256i *) &jumpBases[base]);
+        for (int half = 0; half < 2; half++) {
+            // Widen the byte masks and operands of 16 lanes to words
+            __m256i mask16 = _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(mask, 1) : _mm256_castsi256_si128(mask));
+            __m256i skip16 = _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(skip, 1) : _mm256_castsi256_si128(skip));
+            __m256i vx16 = _mm256_cvtepu8_epi16(half ? _mm256_extracti128_si256(vx, 1) : _mm256_castsi256_si128(vx));
+            __m256i jump16 = _mm256_cvtepu8_epi16(half ? _mm256_extracti128_si256(jumpBase, 1) : _mm256_castsi256_si128(jumpBase));
+            __m256i nnn = _mm256_set1_epi16((short) in.nnn);
+            unsigned short *pcs = &programCounter[base + half * 16];
+            unsigned short *indices = &index[base + half * 16];
+
+            __m256i pc = _mm256_loadu_si256((const __m256i *) pcs);
+            __m256i next;
+            if (in.op == Op::Jump) {
+                next = nnn;
+            }
+            else if (in.op == Op::JumpOffset) {
+                next = _mm256_add_epi16(jump16, nnn);
+            }
+            else {
+                __m256i two = _mm256_set1_epi16(2);
+                next = _mm256_add_epi16(_mm256_add_epi16(pc, two), _mm256_and_si256(skip16, two));
+            }
+            _mm256_storeu_si256((__m256i *) pcs, _mm256_blendv_epi8(pc, next, mask16));
+
+            if (in.op == Op::LoadIndex || in.op == Op::AddIndex) {
+                __m256i i = _mm256_loadu_si256((const __m256i *) indices);
+                __m256i nextIndex = in.op == Op::LoadIndex ? nnn : _mm256_add_epi16(i, vx16);
+                _mm256_storeu_si256((__m256i *) indices, _mm256_blendv_epi8(i, nextIndex, mask16));
+            }
+        }
+    }
+}
+#endif
+
+Chip8 &Batch::getLane(int lane) {
+    if (!checkedOut[lane]) {
+        scatter(lane);
+        checkedOut[lane] = 1;
+        memoryWritesSeen[lane] = lanes[lane]->memoryWrites;
+    }
+    return *lanes[lane];
+}
+
+int Batch::getLaneCount() {
+    return lanes.size();
+}
+
+bool Batch::isUsingAvx2() {
+    return useAvx2;
+}
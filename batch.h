@@ -0,0 +1,151 @@
+/*
+Lockstep engine for many instances of the same ROM; executes each instruction across all
+instances whose program counters agree at once, with AVX2 where the host has it
+*/
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#define BATCH_LANE_ALIGNMENT 32 // Lanes are padded to a multiple of one AVX2 vector of bytes
+#define BATCH_MIN_GROUP_SIZE 4 // Fewest lanes sharing a program counter worth executing as vectors
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BATCH_AVX2_SUPPORTED 1
+#else
+#define BATCH_AVX2_SUPPORTED 0
+#endif
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+class Batch {
+private:
+    // Each lane is a complete machine, except that V0-VF, I and the program counter live in
+    // the structure-of-arrays copies below until the lane is handed out by getLane().
+    // Everything else, and instructions that can't be executed across lanes, go through the
+    // lane's own Chip8
+    std::vector<std::unique_ptr<Chip8>> lanes;
+    // Set for lanes whose Chip8 holds their registers, i.e. handed out since the last runCycles()
+    std::vector<unsigned char> checkedOut;
+    Variant variant;
+    QuirkFlags quirks;
+    int stride; // Lane count rounded up to BATCH_LANE_ALIGNMENT
+    bool useAvx2;
+
+    // registers[r * stride + lane] holds Vr of a lane
+    std::vector<unsigned char> registers;
+    std::vector<unsigned short> index;
+    std::vector<unsigned short> programCounter;
+    // 0xFF for the lanes taking part in the group being executed, and for every lane
+    std::vector<unsigned char> groupMask;
+    std::vector<unsigned char> laneMask;
+    // Lanes waiting on 0xFx0A, which sit out their cycles
+    std::vector<unsigned char> waiting;
+    int waitingLanes = 0;
+    // Addresses some lane has written since the game was loaded; elsewhere every lane holds
+    // the same code, so lanes at the same address run the same instruction
+    bool written[4096];
+    // Each lane's Chip8::memoryWrites when it was handed out
+    std::vector<unsigned int> memoryWritesSeen;
+    // Lanes at the same address are chained in lane order from a leader: nextInGroup links
+    // them, and the last lane added for each address is in groupTail, which is valid only
+    // while groupStamp matches the current cycle's stamp. Stamps are 64-bit so they never
+    // wrap back to a value left in groupStamp, or to the 0 of addresses never visited
+    std::vector<int> leaders;
+    std::vector<int> nextInGroup;
+    int groupTail[4096];
+    uint64_t groupStamp[4096] = {};
+    uint64_t stamp = 0;
+
+    /*
+    Copies the registers of a lane into the structure-of-arrays layout, and back
+    */
+    void gather(int lane);
+    void scatter(int lane);
+
+    /*
+    Returns the opcode at a lane's program counter
+    */
+    unsigned short fetchOpcode(int lane);
+
+    /*
+    Check if no lane has written either byte of the instruction at pc
+    */
+    bool isCodeShared(unsigned short pc);
+
+    /*
+    Executes one cycle on every lane
+    */
+    void cycle();
+
+    /*
+    Executes an instruction on the lanes whose byte in mask is 0xFF; returns false if the
+    operation can only run one lane at a time
+    */
+    bool executeGroup(const Instruction &in, const unsigned char *mask);
+#if BATCH_AVX2_SUPPORTED
+    void executeGroupAvx2(const Instruction &in, const unsigned char *members);
+#endif
+
+    /*
+    Executes the instruction at one lane's program counter; instructions outside the
+    registers go through the lane's Chip8
+    */
+    void executeLane(int lane);
+
+    /*
+    Executes an instruction that only touches registers on one lane
+    */
+    void executeLaneParallel(int lane, const Instruction &in);
+
+public:
+    /*
+    Creates the lanes; every lane runs the given variant
+    */
+    Batch(int laneCount, Variant variant = Variant::Modern);
+    ~Batch();
+
+    /*
+    Loads a game into every lane, reading the file once
+    */
+    void loadGame(std::string fileName);
+
+    /*
+    Loads a game that is already in memory into every lane
+    */
+    void loadGame(const unsigned char *data, size_t size);
+
+    /*
+    Runs cycles instructions on every lane; the result matches calling emulateCycle()
+    cycles times on each lane separately. Lanes waiting on 0xFx0A sit out their cycles
+    */
+    void runCycles(int cycles);
+
+    /*
+    Updates the key inputs of one lane; see Chip8::setKeyMask()
+    */
+    void setKeyMask(int lane, unsigned short mask);
+
+    /*
+    Decrements the delay and sound timers of every lane
+    */
+    void updateTimers();
+
+    /*
+    Returns a lane's machine, e.g. to seed it or read its display or state. The lane's
+    registers are copied back into it, so prefer setKeyMask() and updateTimers() every
+    frame. The reference may be used until the next runCycles(); the variant must not change
+    */
+    Chip8 &getLane(int lane);
+
+    int getLaneCount();
+
+    /*
+    Check if instructions are executed with AVX2 rather than scalar loops
+    */
+    bool isUsingAvx2();
+};
+
+#endif
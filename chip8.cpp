@@ -1,12 +1,23 @@
-#include <SDL.h>
+#include <algorithm>
 #include <exception>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
-#include <random>
+#include <type_traits>
 #include "chip8.h"
+#include "jit.h"
 
-#include <iostream>
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State must stay trivially copyable");
+
+// Header of a save state file; followed by the raw Chip8State
+struct StateFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t stateSize;
+    uint32_t variant;
+};
 
 Chip8::InitializationError::InitializationError(std::string errorMsg) {
     this->errorMsg = "Initialization error: " + errorMsg;
@@ -16,6 +27,11 @@ const char * Chip8::InitializationError::what() const noexcept {
     return errorMsg.c_str();
 }
 
+// Rotates a display row right by shift pixels, wrapping pixels that leave the right edge
+static inline uint64_t rotateRight(uint64_t row, int shift) {
+    return (row >> shift) | (row << ((64 - shift) & 63));
+}
+
 Chip8::Chip8() {
     // Load fontset into memory
     unsigned char chip8_fontset[80] = { 
@@ -38,250 +54,676 @@ Chip8::Chip8() {
     };
 
     for (int i = 0; i < 80; i++) {
-        memory[i + FONTSET_START_ADDRESS] = chip8_fontset[i];
+        state.memory[i + FONTSET_START_ADDRESS] = chip8_fontset[i];
     }
+
+    setVariant(Variant::Modern);
 }
 
 Chip8::~Chip8() {
     
 }
 
-void Chip8::loadGame(std::string fileName) {
-    std::ifstream fin(fileName, std::ios::binary);
+void Chip8::loadGame(std::string fileName, Variant variant) {
+    std::vector<unsigned char> rom = readRom(fileName);
+    loadGame(rom.data(), rom.size(), variant);
+}
+
+void Chip8::loadGame(const unsigned char *data, size_t size, Variant variant) {
+    size_t programSpace = getQuirkFlags(variant).programEnd - PROGRAM_START_ADDRESS;
+    if (size > programSpace) {
+        throw Chip8::InitializationError("ROM is " + std::to_string(size) + " bytes; " +
+                                         getVariantName(variant) + " programs can be at most " +
+                                         std::to_string(programSpace));
+    }
+    setVariant(variant);
+
+    // Copy and hash in one pass
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        state.memory[PROGRAM_START_ADDRESS + i] = data[i];
+        invalidateCode(PROGRAM_START_ADDRESS + i);
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    romHash = hash;
+}
+
+uint64_t Chip8::getRomHash() {
+    return romHash;
+}
+
+uint64_t Chip8::hashRom(const unsigned char *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+std::vector<unsigned char> Chip8::readRom(std::string fileName) {
+    std::ifstream fin(fileName, std::ios::binary | std::ios::ate);
     if (!fin.is_open()) {
         throw Chip8::InitializationError("Unable to open game file");
     }
 
-    unsigned char nextCode;
-    int counter = 0;
-    while (fin >> std::noskipws >> nextCode) {
-        memory[counter + PROGRAM_START_ADDRESS] = nextCode;
-        printf("%02X", nextCode);
-        counter++;
+    std::streamoff size = fin.tellg();
+    if (size < 0 || size > MAX_ROM_SIZE) {
+        throw Chip8::InitializationError("Game file is larger than " + std::to_string(MAX_ROM_SIZE) + " bytes");
     }
-
-    fin.close();
+    std::vector<unsigned char> rom(size);
+    fin.seekg(0);
+    if (!fin.read((char *) rom.data(), size)) {
+        throw Chip8::InitializationError("Unable to read game file");
+    }
+    return rom;
 }
 
 void Chip8::initializeInput() {
 
 }
 
+void Chip8::writeMemory(unsigned short address, unsigned char value) {
+    address &= 0xFFF;
+    state.memory[address] = value;
+    invalidateCode(address);
+}
+
+void Chip8::invalidateCode(unsigned short address) {
+    memoryWrites++;
+    // Both the instruction starting at this byte and the one starting just before it
+    // contain the byte, so both have to be decoded again
+    decodeCache[address].op = Op::Undecoded;
+    decodeCache[(address - 1) & 0xFFF].op = Op::Undecoded;
+    if (jit) {
+        jit->invalidate(address);
+    }
+}
+
+template <typename Quirks>
+const Chip8::Handler *Chip8::handlerTable() {
+    static const Handler table[(int) Op::Count] = {
+        nullptr,                    // Undecoded; never dispatched
+        &Chip8::opNop,
+        &Chip8::opClearScreen,
+        &Chip8::opReturn,
+        &Chip8::opJump,
+        &Chip8::opCall,
+        &Chip8::opSkipEqualImm,
+        &Chip8::opSkipNotEqualImm,
+        &Chip8::opSkipEqualReg,
+        &Chip8::opLoadImm,
+        &Chip8::opAddImm,
+        &Chip8::opMove,
+        &Chip8::opOr<Quirks>,
+        &Chip8::opAnd<Quirks>,
+        &Chip8::opXor<Quirks>,
+        &Chip8::opAddReg,
+        &Chip8::opSubReg,
+        &Chip8::opShiftRight<Quirks>,
+        &Chip8::opSubReverse,
+        &Chip8::opShiftLeft<Quirks>,
+        &Chip8::opSkipNotEqualReg,
+        &Chip8::opLoadIndex,
+        &Chip8::opJumpOffset<Quirks>,
+        &Chip8::opRandom,
+        &Chip8::opDraw<Quirks>,
+        &Chip8::opSkipKeyPressed,
+        &Chip8::opSkipKeyNotPressed,
+        &Chip8::opLoadDelay,
+        &Chip8::opWaitKey,
+        &Chip8::opSetDelay,
+        &Chip8::opSetSound,
+        &Chip8::opAddIndex,
+        &Chip8::opLoadFont,
+        &Chip8::opStoreBCD,
+        &Chip8::opStoreRegisters<Quirks>,
+        &Chip8::opLoadRegisters<Quirks>,
+    };
+    return table;
+}
+
+const Instruction &Chip8::fetchInstruction() {
+    Instruction &instruction = decodeCache[state.programCounter & 0xFFF];
+    if (instruction.op == Op::Undecoded) {
+        unsigned short opcode = state.memory[state.programCounter & 0xFFF] << 8 | state.memory[(state.programCounter + 1) & 0xFFF];
+        instruction = decodeInstruction(opcode);
+    }
+    return instruction;
+}
+
+void Chip8::step() {
+    const Instruction &instruction = fetchInstruction();
+    state.programCounter += 2;
+    (this->*handlers[(int) instruction.op])(instruction);
+}
+
 void Chip8::emulateCycle() {
-    static unsigned short opcode;
-    if (pausedForKeyPress) {
-        setKeys((opcode & 0x0F00) >> 8); // Update key binds
+    if (state.pausedForKeyPress) {
+        return; // Resumed by setKeyMask() once a key is released
+    }
+
+    step();
+}
+
+void Chip8::runCycles(int cycles) {
+    if (engine == Engine::Threaded) {
+        (this->*threadedRunner)(cycles);
+        return;
+    }
+    if (engine == Engine::Recompiler && jit->isAvailable()) {
+        jit->run(*this, cycles);
         return;
     }
 
-    opcode = memory[programCounter] << 8 | memory[programCounter + 1];
-    programCounter += 2;
+    for (int i = 0; i < cycles && !state.pausedForKeyPress; i++) {
+        step();
+    }
+}
 
-    int x, y, n; // Used to store (x, y) coords for drawing commands, and the size of sprite in n
-    unsigned short sum; // Used to store sums for some cases
-    short int difference; // Used to store differences for some cases
-    
-    switch(opcode & 0xF000) {
-        case 0x0000:
-            switch(opcode & 0x000F) {
-                case 0x0000: // 0x00E0: Clears display
-                    clearScreen();
-                    break;
-                case 0x000E: // 0x00EE: Returns from subroutine
-                    programCounter = stack[--stackPointer];
-                    break;
-            }
-            break;
-        case 0x1000: // 0x1nnn: Set program counter to nnn
-            programCounter = opcode & 0x0FFF;
-            break;
-        case 0x2000: // 0x2nnn: Calls subroutine at nnn
-            stack[stackPointer++] = programCounter;
-            programCounter = opcode & 0x0FFF;
-            break;
-        case 0x3000: // 0x3xkk: Skip next instruction if register Vx == kk
-            if (registers[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) {
-                programCounter += 2;
-            }
-            break;
-        case 0x4000: // 0x4xkk: Skip next instruction if register Vx != kk
-            if (registers[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) {
-                programCounter += 2;
-            }
-            break;
-        case 0x5000: // 0x5xy0: Skip next instruction if Vx == Vy
-            if (registers[(opcode & 0x0F00) >> 8] == registers[(opcode & 0x0F0) >> 4]) {
-                programCounter += 2;
-            }
-            break;
-        case 0x6000: // 0x6xkk: Set Vx = kk
-            registers[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-            break;
-        case 0x7000: // 0x7xkk: Increment Vx by kk
-            registers[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-            break;
-        case 0x8000:
-            switch(opcode & 0x000F) {
-                case 0x0: // 0x8xy0: Set Vx = Vy
-                    registers[(opcode & 0x0F00) >> 8] = registers[(opcode & 0x00F0) >> 4];
-                    break;
-                case 0x1: // 0x8xy1: Set Vx = Vx OR Vy
-                    registers[(opcode & 0x0F00) >> 8] |= registers[(opcode & 0x00F0) >> 4];
-                    break;
-                case 0x2: // 0x8xy2: Set Vx = Vx AND Vy
-                    registers[(opcode & 0x0F00) >> 8] &= registers[(opcode & 0x00F0) >> 4];
-                    break;
-                case 0x3: // 0x8xy3: Set Vx = Vx XOR Vy
-                    registers[(opcode & 0x0F00) >> 8] ^= registers[(opcode & 0x00F0) >> 4];
-                    break;
-                case 0x4: // 0x8xy4: Set Vx = Vx + Vy, and VF = carry
-                    sum = registers[(opcode & 0x0F00) >> 8] + registers[(opcode & 0x00F0) >> 4];
-                    registers[(opcode & 0x0F00) >> 8] = sum & 0x00FF;
-                    registers[0xF] = (sum > 0x00FF) ? 1 : 0;
-                    break;
-                case 0x5: // 0x8xy5: Set Vx = Vx - Vy, and VF = NOT borrow
-                    difference = registers[(opcode & 0x0F00) >> 8] - registers[(opcode & 0x00F0) >> 4];
-                    registers[(opcode & 0x0F00) >> 8] = (unsigned char) difference;
-                    registers[0xF] = (difference > 0) ? 1 : 0;
-                    break;
-                case 0x6: // 0x8xy6: If LSb of Vx is 1, Set VF = 1; Set Vx = Vx >> 1
-                    registers[0xF] = ((registers[(opcode & 0x0F00) >> 8] & 0x01) == 1) ? 1 : 0;
-                    registers[(opcode & 0x0F00) >> 8] >>= 1;
-                    break;
-                case 0x7: // 0x8xy7: Set Vx = Vy - Vx, and VF = NOT borrow
-                    difference = registers[(opcode & 0x00F0) >> 4] - registers[(opcode & 0x0F00) >> 8];
-                    registers[(opcode & 0x0F00) >> 8] = (unsigned char) difference;
-                    registers[0xF] = (difference > 0) ? 1 : 0;
-                    break;
-                case 0xE: // 0x8xyE: If MSb of Vx is 1, Set VF = 1; Set Vx = Vx << 1
-                    registers[0xF] = ((registers[(opcode & 0x0F00) >> 8] & 0x80) == 0x80) ? 1 : 0;
-                    registers[(opcode & 0x0F00) >> 8] <<= 1;
-                    break;
+void Chip8::runTimed(long long cycles) {
+    // A clock speed below TIMERS_FREQUENCY, or a state saved at a higher one, can leave
+    // more than one tick due
+    while (state.timerPhase >= clockSpeed) {
+        state.timerPhase -= clockSpeed;
+        updateTimers();
+    }
+    while (cycles > 0) {
+        // A machine waiting on 0xFx0A stays suspended until setKeyMask(), so the rest of
+        // the batch only counts down the timers
+        if (state.pausedForKeyPress) {
+            advanceTimers(cycles);
+            return;
+        }
+        // Cycles until timerPhase reaches clockSpeed, rounded up
+        long long untilTick = (clockSpeed - state.timerPhase + TIMERS_FREQUENCY - 1) / TIMERS_FREQUENCY;
+        int batch = (int) std::min(cycles, untilTick);
+        int loopLength = runSkippingIdleLoops(batch);
+        cycles -= batch;
+        state.timerPhase += batch * TIMERS_FREQUENCY;
+        while (state.timerPhase >= clockSpeed) {
+            state.timerPhase -= clockSpeed;
+            updateTimers();
+        }
+        // An idle loop that the ticks can't change spins the same way until the keys change,
+        // which can't happen during this call, so only the last partial iteration is run
+        if (loopLength > 0) {
+            runCycles((int) (cycles % loopLength));
+            advanceTimers(cycles);
+            return;
+        }
+    }
+}
+
+void Chip8::advanceTimers(long long cycles) {
+    uint64_t phase = state.timerPhase + (uint64_t) cycles * TIMERS_FREQUENCY;
+    uint64_t ticks = phase / clockSpeed;
+    state.timerPhase = phase % clockSpeed;
+    state.delayTimer = ticks < state.delayTimer ? state.delayTimer - ticks : 0;
+    state.soundTimer = ticks < state.soundTimer ? state.soundTimer - ticks : 0;
+}
+
+// Instructions that only read and write V0-VF and I, or the PC, and read the delay timer
+// or the keys
+static bool isIdleLoopOp(Op op) {
+    switch (op) {
+    case Op::Nop: case Op::Jump: case Op::JumpOffset:
+    case Op::SkipEqualImm: case Op::SkipNotEqualImm: case Op::SkipEqualReg: case Op::SkipNotEqualReg:
+    case Op::LoadImm: case Op::AddImm: case Op::Move: case Op::Or: case Op::And: case Op::Xor:
+    case Op::AddReg: case Op::SubReg: case Op::ShiftRight: case Op::SubReverse: case Op::ShiftLeft:
+    case Op::LoadIndex: case Op::AddIndex: case Op::LoadFont:
+    case Op::SkipKeyPressed: case Op::SkipKeyNotPressed: case Op::LoadDelay:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int Chip8::findIdleLoop(int &cycles, bool &readsDelay) {
+    unsigned char registers[16];
+    memcpy(registers, state.registers, sizeof(registers));
+    unsigned short index = state.index;
+    unsigned short start = state.programCounter;
+    readsDelay = false;
+
+    for (int length = 1; length <= IDLE_LOOP_MAX_LENGTH && cycles > 0; length++) {
+        Op op = fetchInstruction().op;
+        if (!isIdleLoopOp(op)) {
+            return 0;
+        }
+        readsDelay |= op == Op::LoadDelay;
+        step();
+        cycles--;
+        if (state.programCounter == start) {
+            bool unchanged = state.index == index && memcmp(registers, state.registers, sizeof(registers)) == 0;
+            return unchanged ? length : 0;
+        }
+    }
+    return 0;
+}
+
+int Chip8::runSkippingIdleLoops(int cycles) {
+    // A check runs its instructions through step(), which is slower than the other engines,
+    // so after a miss the next one waits for IDLE_LOOP_CHECK_INTERVAL cycles. After a hit the
+    // next batch checks straight away, as the loop usually spans many ticks
+    while (cycles > 0 && !state.pausedForKeyPress) {
+        if (cyclesSinceIdleCheck >= IDLE_LOOP_CHECK_INTERVAL) {
+            bool readsDelay;
+            int length = findIdleLoop(cycles, readsDelay);
+            if (length > 0) {
+                runCycles(cycles % length);
+                return readsDelay && state.delayTimer != 0 ? 0 : length;
             }
-            break;
-        case 0x9000: // 0x9xy0: Skip next instruction if Vx != Vy
-            if (registers[(opcode & 0x0F00) >> 8] != registers[(opcode & 0x0F0) >> 4]) {
-                programCounter += 2;
+            // Running out of cycles mid-iteration doesn't count as a miss
+            if (cycles > 0) {
+                cyclesSinceIdleCheck = 0;
             }
+            continue;
+        }
+        int batch = std::min(cycles, IDLE_LOOP_CHECK_INTERVAL - cyclesSinceIdleCheck);
+        runCycles(batch);
+        cycles -= batch;
+        cyclesSinceIdleCheck += batch;
+    }
+    runCycles(cycles);
+    return 0;
+}
+
+void Chip8::setClockSpeed(unsigned int clockSpeed) {
+    if (clockSpeed == 0) {
+        clockSpeed = 1;
+    }
+    state.timerPhase = (uint64_t) state.timerPhase * clockSpeed / this->clockSpeed;
+    this->clockSpeed = clockSpeed;
+}
+
+unsigned int Chip8::getClockSpeed() {
+    return clockSpeed;
+}
+
+#if defined(__GNUC__)
+template <typename Quirks>
+void Chip8::runThreaded(int cycles) {
+    // Same order as Op; every handler ends in its own indirect jump to the next handler,
+    // which gives the branch predictor one jump site per handler instead of a shared one
+    static void *const labels[(int) Op::Count] = {
+        &&undecoded, &&nop, &&clearScreen, &&ret, &&jump, &&call,
+        &&skipEqualImm, &&skipNotEqualImm, &&skipEqualReg, &&loadImm, &&addImm,
+        &&move, &&bitOr, &&bitAnd, &&bitXor, &&addReg, &&subReg, &&shiftRight, &&subReverse, &&shiftLeft,
+        &&skipNotEqualReg, &&loadIndex, &&jumpOffset, &&random, &&draw,
+        &&skipKeyPressed, &&skipKeyNotPressed, &&loadDelay, &&waitKey, &&setDelay, &&setSound,
+        &&addIndex, &&loadFont, &&storeBCD, &&storeRegisters, &&loadRegisters,
+    };
+
+    const Instruction *in;
+    int remaining = cycles;
+
+    #define DISPATCH() \
+        if (remaining-- <= 0) { \
+            return; \
+        } \
+        in = &fetchInstruction(); \
+        state.programCounter += 2; \
+        goto *labels[(int) in->op]
+
+    if (state.pausedForKeyPress) {
+        return;
+    }
+    DISPATCH();
+
+    undecoded: return; // fetchInstruction() never returns an undecoded entry
+    nop: opNop(*in); DISPATCH();
+    clearScreen: opClearScreen(*in); DISPATCH();
+    ret: opReturn(*in); DISPATCH();
+    jump: opJump(*in); DISPATCH();
+    call: opCall(*in); DISPATCH();
+    skipEqualImm: opSkipEqualImm(*in); DISPATCH();
+    skipNotEqualImm: opSkipNotEqualImm(*in); DISPATCH();
+    skipEqualReg: opSkipEqualReg(*in); DISPATCH();
+    loadImm: opLoadImm(*in); DISPATCH();
+    addImm: opAddImm(*in); DISPATCH();
+    move: opMove(*in); DISPATCH();
+    bitOr: opOr<Quirks>(*in); DISPATCH();
+    bitAnd: opAnd<Quirks>(*in); DISPATCH();
+    bitXor: opXor<Quirks>(*in); DISPATCH();
+    addReg: opAddReg(*in); DISPATCH();
+    subReg: opSubReg(*in); DISPATCH();
+    shiftRight: opShiftRight<Quirks>(*in); DISPATCH();
+    subReverse: opSubReverse(*in); DISPATCH();
+    shiftLeft: opShiftLeft<Quirks>(*in); DISPATCH();
+    skipNotEqualReg: opSkipNotEqualReg(*in); DISPATCH();
+    loadIndex: opLoadIndex(*in); DISPATCH();
+    jumpOffset: opJumpOffset<Quirks>(*in); DISPATCH();
+    random: opRandom(*in); DISPATCH();
+    draw: opDraw<Quirks>(*in); DISPATCH();
+    skipKeyPressed: opSkipKeyPressed(*in); DISPATCH();
+    skipKeyNotPressed: opSkipKeyNotPressed(*in); DISPATCH();
+    loadDelay: opLoadDelay(*in); DISPATCH();
+    waitKey: opWaitKey(*in); return; // Nothing runs until setKeyMask() sees a key release
+    setDelay: opSetDelay(*in); DISPATCH();
+    setSound: opSetSound(*in); DISPATCH();
+    addIndex: opAddIndex(*in); DISPATCH();
+    loadFont: opLoadFont(*in); DISPATCH();
+    storeBCD: opStoreBCD(*in); DISPATCH();
+    storeRegisters: opStoreRegisters<Quirks>(*in); DISPATCH();
+    loadRegisters: opLoadRegisters<Quirks>(*in); DISPATCH();
+
+    #undef DISPATCH
+}
+#else
+template <typename Quirks>
+void Chip8::runThreaded(int cycles) {
+    // Computed gotos are a GCC/Clang extension; fall back to table dispatch elsewhere
+    for (int i = 0; i < cycles && !state.pausedForKeyPress; i++) {
+        step();
+    }
+}
+#endif
+
+void Chip8::setEngine(Engine engine) {
+    if (engine == Engine::Recompiler && !jit) {
+        jit.reset(new Jit());
+    }
+    this->engine = engine;
+}
+
+Engine Chip8::getEngine() {
+    return engine;
+}
+
+void Chip8::setVariant(Variant variant) {
+    this->variant = variant;
+    switch (variant) {
+        case Variant::Original:
+            handlers = handlerTable<OriginalQuirks>();
+            threadedRunner = &Chip8::runThreaded<OriginalQuirks>;
             break;
-        case 0xA000: // 0xAnnn: Set index register = nnn
-            index = opcode & 0x0FFF;
+        case Variant::Chip48:
+            handlers = handlerTable<Chip48Quirks>();
+            threadedRunner = &Chip8::runThreaded<Chip48Quirks>;
             break;
-        case 0xB000: // 0xBnnn: Jump to location nnn + V0
-            programCounter = registers[0] + (opcode & 0x0FFF);
+        case Variant::SuperChip:
+            handlers = handlerTable<SuperChipQuirks>();
+            threadedRunner = &Chip8::runThreaded<SuperChipQuirks>;
             break;
-        case 0xC000: // 0xCxkk: Set Vx = random byte AND kk
-            registers[(opcode & 0x0F00) >> 8] = (rand() % 255) & (opcode & 0x00FF);
+        default:
+            handlers = handlerTable<ModernQuirks>();
+            threadedRunner = &Chip8::runThreaded<ModernQuirks>;
             break;
-        case 0xD000: // 0xDxyn: Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
-            x = registers[(opcode & 0x0F00) >> 8] % 64;
-            y = registers[(opcode & 0x00F0) >> 4] % 32;
-            n = opcode & 0x000F;
-
-            for (int j = 0; j < n; j++) {
-                unsigned char sprite = memory[index + j];
-                for (int i = 0; i < 8; i++) {
-                    bool isWhite = (sprite & (0x80 >> i)) > 0;
-                    if (isWhite) {
-                        unsigned short pixelIndex = 64 * ((y + j) % 32) + ((x + i) % 64);
-                        registers[0xF] = display[pixelIndex] ? 1 : 0;
-                        display[pixelIndex] = display[pixelIndex] != isWhite;
-                    }
-                }
-            }
+    }
+    // Recompiled code bakes in the quirks of the variant it was compiled for
+    if (jit) {
+        jit->flush();
+    }
+}
 
-            break;
-        case 0xE000:
-            switch (opcode & 0x000F) {
-                case 0xE: // 0xEx9E: Skip next instruction if key with value Vx is pressed
-                    if (keys[registers[(opcode & 0x0F00) >> 8]]) {
-                        programCounter += 2;
-                    }
-                    break;
-                case 0x1: // 0xExA1: Skip next instruction if key with value Vx is not pressed.
-                    if (!keys[registers[(opcode & 0x0F00) >> 8]]) {
-                        programCounter += 2;
-                    }
-                    break;
-            }
-            break;
-        case 0xF000:
-            switch (opcode & 0x00FF) {
-                case 0x07: // 0xFx07: Set Vx to delay timer value
-                    registers[(opcode & 0x0F00) >> 8] = delayTimer;
-                    break;
-                case 0x0A: // 0xFx0A: Wait for a key press, store the value of the key in Vx
-                    pausedForKeyPress = true;
-                    break;
-                case 0x15: // 0xFx15: Set delay timer = Vx
-                    delayTimer = registers[(opcode & 0x0F00) >> 8];
-                    break;
-                case 0x18: // 0xFx18: Set sound timer = Vx
-                    soundTimer = registers[(opcode & 0x0F00) >> 8];
-                    break;
-                case 0x1E: // 0xFx1E: Set index register += Vx
-                    index += registers[(opcode & 0x0F00) >> 8];
-                    break;
-                case 0x29: // 0xFx29: Set index register = location of sprite for digit Vx.
-                    index = memory[0x050 + 5 * (registers[(opcode & 0x0F00) >> 8] & 0xF)];
-                    break;
-                case 0x33: // 0xFx33: Store BCD representation of Vx in mem locations index, index+1, and index+2
-                    memory[index] = registers[(opcode & 0x0F00) >> 8] / 100;
-                    memory[index + 1] = (registers[(opcode & 0x0F00) >> 8] % 100) / 10;
-                    memory[index + 2] = registers[(opcode & 0x0F00) >> 8] % 10;
-                    break;
-                case 0x55: // 0xFx55: Copy V0 to Vx to memory, starting from mem location index
-                    for (int i = 0; i <= (opcode & 0x0F00) >> 8; i++) {
-                        memory[i + index] = registers[i];
-                    }
-                    break;
-                case 0x65: // 0xFx65: Copy values from memory into V0 to Vx, starting from mem location index
-                    for (int i = 0; i <= (opcode & 0x0F00) >> 8; i++) {
-                        registers[i] = memory[i + index];
-                    }
-                    break;
-            }
-            break;
+Variant Chip8::getVariant() {
+    return variant;
+}
+
+// Instruction handlers
+
+void Chip8::opNop(const Instruction &) {
+
+}
+
+void Chip8::opClearScreen(const Instruction &) {
+    clearScreen();
+}
+
+void Chip8::opReturn(const Instruction &) {
+    state.stackPointer = (state.stackPointer - 1) & 0xF;
+    state.programCounter = state.stack[state.stackPointer];
+}
+
+void Chip8::opJump(const Instruction &in) {
+    state.programCounter = in.nnn;
+}
+
+void Chip8::opCall(const Instruction &in) {
+    state.stack[state.stackPointer & 0xF] = state.programCounter;
+    state.stackPointer = (state.stackPointer + 1) & 0xF;
+    state.programCounter = in.nnn;
+}
+
+void Chip8::opSkipEqualImm(const Instruction &in) {
+    if (state.registers[in.x] == in.kk) {
+        state.programCounter += 2;
     }
+}
 
-    setKeys((opcode & 0x0F00) >> 8); // Update key binds
+void Chip8::opSkipNotEqualImm(const Instruction &in) {
+    if (state.registers[in.x] != in.kk) {
+        state.programCounter += 2;
+    }
 }
 
-void Chip8::clearScreen() {
-    for (int i = 0; i < 64 * 32; i++) {
-        display[i] = false;
+void Chip8::opSkipEqualReg(const Instruction &in) {
+    if (state.registers[in.x] == state.registers[in.y]) {
+        state.programCounter += 2;
     }
 }
 
-void Chip8::setKeys(int registerIndex) {
-    const unsigned char *keyState = SDL_GetKeyboardState(NULL);
-    if (keyState == nullptr) {
-        return;
+void Chip8::opLoadImm(const Instruction &in) {
+    state.registers[in.x] = in.kk;
+}
+
+void Chip8::opAddImm(const Instruction &in) {
+    state.registers[in.x] += in.kk;
+}
+
+void Chip8::opMove(const Instruction &in) {
+    state.registers[in.x] = state.registers[in.y];
+}
+
+template <typename Quirks>
+void Chip8::opOr(const Instruction &in) {
+    state.registers[in.x] |= state.registers[in.y];
+    if (Quirks::logicResetsVF) {
+        state.registers[0xF] = 0;
     }
+}
 
-    for (int i = 0; i < 16; i++) {
-        if (keyState[keybinds[i]]) {
-            keys[i] = true;
-        }
-        else {
-            keys[i] = false;
-            if (pausedForKeyPress && prevKeys[i]) {
-                registers[registerIndex] = i;
-                pausedForKeyPress = false;
-            }
-        }
-        prevKeys[i] = keys[i]; // Update previous keys
+template <typename Quirks>
+void Chip8::opAnd(const Instruction &in) {
+    state.registers[in.x] &= state.registers[in.y];
+    if (Quirks::logicResetsVF) {
+        state.registers[0xF] = 0;
+    }
+}
+
+template <typename Quirks>
+void Chip8::opXor(const Instruction &in) {
+    state.registers[in.x] ^= state.registers[in.y];
+    if (Quirks::logicResetsVF) {
+        state.registers[0xF] = 0;
+    }
+}
+
+void Chip8::opAddReg(const Instruction &in) {
+    unsigned short sum = state.registers[in.x] + state.registers[in.y];
+    state.registers[in.x] = sum & 0x00FF;
+    state.registers[0xF] = (sum > 0x00FF) ? 1 : 0;
+}
+
+void Chip8::opSubReg(const Instruction &in) {
+    short int difference = state.registers[in.x] - state.registers[in.y];
+    state.registers[in.x] = (unsigned char) difference;
+    state.registers[0xF] = (difference > 0) ? 1 : 0;
+}
+
+template <typename Quirks>
+void Chip8::opShiftRight(const Instruction &in) {
+    unsigned char value = Quirks::shiftUsesVy ? state.registers[in.y] : state.registers[in.x];
+    state.registers[in.x] = value >> 1;
+    state.registers[0xF] = value & 0x01;
+}
+
+void Chip8::opSubReverse(const Instruction &in) {
+    short int difference = state.registers[in.y] - state.registers[in.x];
+    state.registers[in.x] = (unsigned char) difference;
+    state.registers[0xF] = (difference > 0) ? 1 : 0;
+}
+
+template <typename Quirks>
+void Chip8::opShiftLeft(const Instruction &in) {
+    unsigned char value = Quirks::shiftUsesVy ? state.registers[in.y] : state.registers[in.x];
+    state.registers[in.x] = value << 1;
+    state.registers[0xF] = (value & 0x80) >> 7;
+}
+
+void Chip8::opSkipNotEqualReg(const Instruction &in) {
+    if (state.registers[in.x] != state.registers[in.y]) {
+        state.programCounter += 2;
     }
+}
 
+void Chip8::opLoadIndex(const Instruction &in) {
+    state.index = in.nnn;
+}
+
+template <typename Quirks>
+void Chip8::opJumpOffset(const Instruction &in) {
+    state.programCounter = state.registers[Quirks::jumpUsesVx ? in.x : 0] + in.nnn;
+}
+
+void Chip8::opRandom(const Instruction &in) {
+    state.registers[in.x] = nextRandomByte() & in.kk;
+}
+
+template <typename Quirks>
+void Chip8::opDraw(const Instruction &in) {
+    // The starting position always wraps; the sprite itself wraps or is clipped at the edges
+    int x = state.registers[in.x] % SCREEN_WIDTH;
+    int y = state.registers[in.y] % SCREEN_HEIGHT;
+    int rows = Quirks::clipSprites && y + in.n > SCREEN_HEIGHT ? SCREEN_HEIGHT - y : in.n;
+
+    // Draw a whole sprite row at a time: shift it into place, XOR it onto the
+    // screen and collect the pixels it turned off
+    uint64_t collision = 0;
+    for (int j = 0; j < rows; j++) {
+        uint64_t sprite = (uint64_t) state.memory[(state.index + j) & 0xFFF] << 56;
+        uint64_t spriteRow = Quirks::clipSprites ? sprite >> x : rotateRight(sprite, x);
+        uint64_t &displayRow = state.display[(y + j) % SCREEN_HEIGHT];
+        collision |= displayRow & spriteRow;
+        displayRow ^= spriteRow;
+    }
+    state.registers[0xF] = collision ? 1 : 0;
+}
+
+void Chip8::opSkipKeyPressed(const Instruction &in) {
+    if (getKey(state.registers[in.x])) {
+        state.programCounter += 2;
+    }
+}
+
+void Chip8::opSkipKeyNotPressed(const Instruction &in) {
+    if (!getKey(state.registers[in.x])) {
+        state.programCounter += 2;
+    }
+}
+
+void Chip8::opLoadDelay(const Instruction &in) {
+    state.registers[in.x] = state.delayTimer;
+}
+
+void Chip8::opWaitKey(const Instruction &in) {
+    state.pausedForKeyPress = true;
+    state.keyWaitRegister = in.x;
+}
+
+void Chip8::opSetDelay(const Instruction &in) {
+    state.delayTimer = state.registers[in.x];
+}
+
+void Chip8::opSetSound(const Instruction &in) {
+    state.soundTimer = state.registers[in.x];
+}
+
+void Chip8::opAddIndex(const Instruction &in) {
+    state.index += state.registers[in.x];
+}
+
+void Chip8::opLoadFont(const Instruction &in) {
+    state.index = state.memory[FONTSET_START_ADDRESS + 5 * (state.registers[in.x] & 0xF)];
+}
+
+void Chip8::opStoreBCD(const Instruction &in) {
+    writeMemory(state.index, state.registers[in.x] / 100);
+    writeMemory(state.index + 1, (state.registers[in.x] % 100) / 10);
+    writeMemory(state.index + 2, state.registers[in.x] % 10);
+}
+
+template <typename Quirks>
+void Chip8::opStoreRegisters(const Instruction &in) {
+    for (int i = 0; i <= in.x; i++) {
+        writeMemory(state.index + i, state.registers[i]);
+    }
+    if (Quirks::loadStoreIndexIncrement == IndexIncrement::ByX) {
+        state.index += in.x;
+    }
+    else if (Quirks::loadStoreIndexIncrement == IndexIncrement::ByXPlusOne) {
+        state.index += in.x + 1;
+    }
+}
+
+template <typename Quirks>
+void Chip8::opLoadRegisters(const Instruction &in) {
+    for (int i = 0; i <= in.x; i++) {
+        state.registers[i] = state.memory[(state.index + i) & 0xFFF];
+    }
+    if (Quirks::loadStoreIndexIncrement == IndexIncrement::ByX) {
+        state.index += in.x;
+    }
+    else if (Quirks::loadStoreIndexIncrement == IndexIncrement::ByXPlusOne) {
+        state.index += in.x + 1;
+    }
+}
+
+void Chip8::clearScreen() {
+    memset(state.display, 0, sizeof(state.display));
+}
+
+void Chip8::seedRandom(uint64_t seed) {
+    // splitmix64 spreads nearby seeds apart and only maps one seed to zero
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    state.randomState = z != 0 ? z : 0x853C49E6748FEA9BULL;
+}
+
+unsigned char Chip8::nextRandomByte() {
+    uint64_t x = state.randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    state.randomState = x;
+    // The high bits of the xorshift64* output are the best distributed
+    return (unsigned char) ((x * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+void Chip8::setKeyMask(unsigned short mask) {
+    unsigned short released = state.keyMask & ~mask;
+    state.keyMask = mask;
+
+    if (state.pausedForKeyPress && released) {
+        // Store the lowest released key
+        int key = 0;
+        while (!(released & (1 << key))) {
+            key++;
+        }
+        state.registers[state.keyWaitRegister] = key;
+        state.pausedForKeyPress = false;
+    }
 }
 
 void Chip8::updateTimers() {
-    if (soundTimer > 0) {
+    if (state.soundTimer > 0) {
         // PLAY SOUND
-        soundTimer--;
+        state.soundTimer--;
     }
-    if (delayTimer > 0) {
-        delayTimer--;
+    if (state.delayTimer > 0) {
+        state.delayTimer--;
     }
 }
 
@@ -294,39 +736,119 @@ void Chip8::togglePaused() {
 }
 
 bool Chip8::isPausedForKeyPress() {
-    return pausedForKeyPress;
+    return state.pausedForKeyPress;
+}
+
+int Chip8::getKeyWaitRegister() {
+    return state.pausedForKeyPress ? state.keyWaitRegister : -1;
+}
+
+void Chip8::saveState(Chip8State &state) {
+    memcpy(&state, &this->state, sizeof(Chip8State));
+}
+
+void Chip8::loadState(const Chip8State &state) {
+    // Compare memory a word at a time and only drop code for the bytes that differ;
+    // restoring a snapshot of the same program usually changes a handful of bytes
+    for (int i = 0; i < 4096; i += 8) {
+        uint64_t current, restored;
+        memcpy(&current, this->state.memory + i, 8);
+        memcpy(&restored, state.memory + i, 8);
+        if (current != restored) {
+            for (int j = i; j < i + 8; j++) {
+                if (this->state.memory[j] != state.memory[j]) {
+                    invalidateCode(j);
+                }
+            }
+        }
+    }
+    memcpy(&this->state, &state, sizeof(Chip8State));
+}
+
+void Chip8::saveStateToFile(std::string fileName) {
+    std::ofstream fout(fileName, std::ios::binary);
+    if (!fout.is_open()) {
+        throw Chip8::InitializationError("Unable to open save state file");
+    }
+
+    StateFileHeader header;
+    memcpy(header.magic, STATE_FILE_MAGIC, 4);
+    header.version = STATE_FILE_VERSION;
+    header.stateSize = sizeof(Chip8State);
+    header.variant = (uint32_t) variant;
+    fout.write((const char *) &header, sizeof(header));
+    fout.write((const char *) &state, sizeof(Chip8State));
+    if (!fout) {
+        throw Chip8::InitializationError("Unable to write save state file");
+    }
+}
+
+void Chip8::loadStateFromFile(std::string fileName) {
+    std::ifstream fin(fileName, std::ios::binary);
+    if (!fin.is_open()) {
+        throw Chip8::InitializationError("Unable to open save state file");
+    }
+
+    StateFileHeader header;
+    Chip8State loaded;
+    if (!fin.read((char *) &header, sizeof(header)) || memcmp(header.magic, STATE_FILE_MAGIC, 4) != 0) {
+        throw Chip8::InitializationError("Not a save state file");
+    }
+    if (header.version != STATE_FILE_VERSION || header.stateSize != sizeof(Chip8State)) {
+        throw Chip8::InitializationError("Unsupported save state version");
+    }
+    if (!fin.read((char *) &loaded, sizeof(Chip8State))) {
+        throw Chip8::InitializationError("Truncated save state file");
+    }
+    if (header.variant >= VARIANT_COUNT) {
+        throw Chip8::InitializationError("Unknown variant in save state file");
+    }
+    // The file is untrusted: a register index past VF would write outside the registers
+    // when the key wait completes, and a bool holding anything but 0 or 1 is undefined
+    if (loaded.keyWaitRegister > 0xF) {
+        throw Chip8::InitializationError("Invalid key wait register in save state file");
+    }
+    unsigned char paused;
+    memcpy(&paused, &loaded.pausedForKeyPress, 1);
+    loaded.pausedForKeyPress = paused != 0;
+
+    setVariant((Variant) header.variant);
+    loadState(loaded);
 }
 
 // Getters for chip8
 
 unsigned short Chip8::getMemory(unsigned short i) {
-    return memory[i];
+    return state.memory[i];
 }
 unsigned char Chip8::getRegister(int i) {
-    return registers[i];
+    return state.registers[i];
 }
 bool Chip8::getDisplay(int i) {
-    return display[i];
+    return (state.display[i / SCREEN_WIDTH] >> (SCREEN_WIDTH - 1 - i % SCREEN_WIDTH)) & 1;
+}
+uint64_t Chip8::getDisplayRow(int y) {
+    return state.display[y];
 }
 bool Chip8::getKey(int i) {
-    return keys[i];
+    return (state.keyMask >> (i & 0xF)) & 1;
 }
 unsigned short Chip8::getStack(int i) {
-    return stack[i];
+    return state.stack[i];
 }
 unsigned short Chip8::getSoundTimer() {
-    return soundTimer;
+    return state.soundTimer;
 }
 unsigned short Chip8::getDelayTimer() {
-    return delayTimer;
+    return state.delayTimer;
 }
 unsigned short Chip8::getIndex() {
-    return index;
+    return state.index;
 }
 unsigned short Chip8::getProgramCounter() {
-    return programCounter;
+    return state.programCounter;
 }
 unsigned char Chip8::getStackPointer() {
-    return stackPointer;
+    return state.stackPointer;
 }
 
@@ -7,13 +7,37 @@ Driver for Chip8 emulator; simulates a Chip 8 machine
 
 #define FONTSET_START_ADDRESS 0x50
 #define PROGRAM_START_ADDRESS 0x200
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+#define MAX_ROM_SIZE (4096 - PROGRAM_START_ADDRESS) // Largest ROM any variant can load
+#define TIMERS_FREQUENCY 60 // Delay and sound timers tick at 60 Hz
+#define DEFAULT_CLOCK_SPEED 500 // Cycles per second of emulated time used by runTimed()
+#define IDLE_LOOP_MAX_LENGTH 8 // Longest loop, in instructions, that runTimed() fast-forwards
+#define IDLE_LOOP_CHECK_INTERVAL 256 // Cycles after a failed check for an idle loop before the next one
 
-#include <SDL.h>
+#include <cstdint>
 #include <exception>
+#include <memory>
 #include <string>
+#include <vector>
+#include "instruction.h"
+#include "quirks.h"
 
-class Chip8 {
-private:
+// Execution engine used by Chip8::runCycles()
+enum class Engine {
+    Interpreter,    // Dispatches each instruction through the handler table
+    Threaded,       // Computed-goto dispatch; each handler jumps straight to the next one
+    Recompiler,     // Translates basic blocks to x86-64 code; interprets on other hosts
+};
+
+#define STATE_FILE_MAGIC "C8ST"
+#define STATE_FILE_VERSION 3
+
+// Complete architectural state of a CHIP-8 machine. Kept trivially copyable so that a
+// snapshot or restore is a single memcpy
+struct Chip8State {
+    // B&W screen, 64 x 32 pixels; one 64-bit word per row, bit 63 is the leftmost pixel
+    uint64_t display[SCREEN_HEIGHT] = {};
     // 0x000-0x1FF stores Chip-8 interpreter
     // 0x050-0x0A0 - Used for built in 4x5 pixel font set (0-F)
     // 0x200-0xFFF - Program ROM and work RAM
@@ -25,35 +49,171 @@ private:
     unsigned short index = 0;
     // Stores mem address of next instruction; starts at 0x200
     unsigned short programCounter = PROGRAM_START_ADDRESS;
-    //B&W screen, 64 x 32 pixels
-    bool display[64 * 32] = {};
-    // Timers count down from 0 when positive
-    // Buzzer sound will play as long as sound timer is positive
-    unsigned short delayTimer = 0;
-    unsigned short soundTimer = 0;
-    // Stores state of key input: keys are 0x0 to 0xF
-    unsigned char keys[16] = {};
-    // Stores state of key input from previous frame; used to detect key releases
-    unsigned char prevKeys[16] = {};
-    // Stores keybinds on user's system: index i corresponds to the keybind for CHIP-8 key with value i
-    SDL_Scancode keybinds[16] = {
-        SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, 
-        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
-        SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
-        SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
-    };
     // Stack to store addresses that interpreter should interpret when finished w/ subroutine
     unsigned short stack[16] = {};
     // Stack pointer to point to top of stack (points to one element above the top)
     unsigned char stackPointer = 0;
-    // If chip8 is paused by gui
-    bool paused = true;
+    // Register Vx that receives the key once a key press completes (0xFx0A)
+    unsigned char keyWaitRegister = 0;
+    // Timers count down from 0 when positive
+    // Buzzer sound will play as long as sound timer is positive
+    unsigned short delayTimer = 0;
+    unsigned short soundTimer = 0;
+    // Stores state of key input: bit i is set while CHIP-8 key i (0x0 to 0xF) is held
+    unsigned short keyMask = 0;
     // If chip8 is paused for key press
     bool pausedForKeyPress = false;
+    // xorshift64* generator behind 0xCxkk; never zero
+    uint64_t randomState = 0x853C49E6748FEA9BULL;
+    // Emulated time since the last timer tick, counted in steps of 1 / (clock speed *
+    // TIMERS_FREQUENCY) seconds: each cycle adds TIMERS_FREQUENCY, and a tick is due once
+    // it reaches the clock speed
+    uint32_t timerPhase = 0;
+};
+
+class Jit;
+
+class Chip8 {
+    friend class Jit;
+    friend class AotRuntime;
+    friend class Batch;
+
+private:
+    // Architectural state; everything a save state has to capture
+    Chip8State state;
+    // If chip8 is paused by gui
+    bool paused = true;
+    // Engine used to run batches of cycles
+    Engine engine = Engine::Interpreter;
+    // Implementation whose quirks are emulated
+    Variant variant = Variant::Modern;
+    // Cycles per second of emulated time; decides how often runTimed() ticks the timers
+    unsigned int clockSpeed = DEFAULT_CLOCK_SPEED;
+    // Hash of the loaded ROM; see hashRom()
+    uint64_t romHash = 0;
+    // Dynamic recompiler; created the first time Engine::Recompiler is selected
+    std::unique_ptr<Jit> jit;
+    // Number of memory writes so far; lets caches of code skip re-validation when nothing changed
+    unsigned int memoryWrites = 0;
+    // Decoded instruction for every address, filled in the first time an address is executed
+    // and invalidated when a byte it was decoded from is written
+    Instruction decodeCache[4096];
+
+    // Executes one decoded instruction; the program counter already points past it
+    typedef void (Chip8::*Handler)(const Instruction &);
+    // Handler for every operation, indexed by Op; points at the table of the selected variant
+    const Handler *handlers;
+    // Threaded engine instantiated for the selected variant
+    void (Chip8::*threadedRunner)(int cycles);
+    // Cycles run since runTimed() last failed to find an idle loop; counted across timer
+    // ticks, since at usual clock speeds a tick is only a few cycles
+    int cyclesSinceIdleCheck = IDLE_LOOP_CHECK_INTERVAL;
+
+    /*
+    Runs one iteration of the loop at the program counter, as long as it only uses
+    instructions that read and write registers, and checks if the registers and index
+    end up exactly as they started. Such an idle loop depends only on the registers, the
+    delay timer and the keys, so every later iteration is identical until the next timer
+    tick or key change
+    Args:
+        - cycles: Cycles left to run; reduced by the instructions executed
+        - readsDelay: Set if the loop reads the delay timer
+    Returns the length of the loop in instructions, or 0 if it isn't an idle loop
+    */
+    int findIdleLoop(int &cycles, bool &readsDelay);
+
+    /*
+    Runs cycles like runCycles(), skipping over whole iterations of idle loops
+    Returns the length of the idle loop the machine ended in if timer ticks can't change it,
+    i.e. it doesn't read the delay timer or the delay timer is 0; otherwise 0
+    */
+    int runSkippingIdleLoops(int cycles);
+
+    /*
+    Counts down the timers for the ticks that fall within the given number of cycles
+    */
+    void advanceTimers(long long cycles);
+
+    /*
+    Returns the handler table instantiated for a quirk policy
+    */
+    template <typename Quirks>
+    static const Handler *handlerTable();
+
+    /*
+    Writes a byte to memory and invalidates the decoded instructions overlapping it
+    */
+    void writeMemory(unsigned short address, unsigned char value);
+
+    /*
+    Invalidates decoded and recompiled code containing the byte at address
+    */
+    void invalidateCode(unsigned short address);
+
+    /*
+    Returns the decoded instruction at the program counter, decoding it if necessary
+    */
+    const Instruction &fetchInstruction();
+
+    /*
+    Executes the instruction at the program counter with the handler table
+    */
+    void step();
+
+    /*
+    Runs up to cycles instructions with computed-goto dispatch; stops early on 0xFx0A
+    */
+    template <typename Quirks>
+    void runThreaded(int cycles);
+
+    /*
+    Instruction handlers; see instruction.h for the opcode of each. Handlers whose behaviour
+    differs between variants are templates over a quirk policy from quirks.h
+    */
+    void opNop(const Instruction &in);
+    void opClearScreen(const Instruction &in);
+    void opReturn(const Instruction &in);
+    void opJump(const Instruction &in);
+    void opCall(const Instruction &in);
+    void opSkipEqualImm(const Instruction &in);
+    void opSkipNotEqualImm(const Instruction &in);
+    void opSkipEqualReg(const Instruction &in);
+    void opLoadImm(const Instruction &in);
+    void opAddImm(const Instruction &in);
+    void opMove(const Instruction &in);
+    template <typename Quirks> void opOr(const Instruction &in);
+    template <typename Quirks> void opAnd(const Instruction &in);
+    template <typename Quirks> void opXor(const Instruction &in);
+    void opAddReg(const Instruction &in);
+    void opSubReg(const Instruction &in);
+    template <typename Quirks> void opShiftRight(const Instruction &in);
+    void opSubReverse(const Instruction &in);
+    template <typename Quirks> void opShiftLeft(const Instruction &in);
+    void opSkipNotEqualReg(const Instruction &in);
+    void opLoadIndex(const Instruction &in);
+    template <typename Quirks> void opJumpOffset(const Instruction &in);
+    void opRandom(const Instruction &in);
+
+    /*
+    Advances the random number generator and returns its next byte
+    */
+    unsigned char nextRandomByte();
+    template <typename Quirks> void opDraw(const Instruction &in);
+    void opSkipKeyPressed(const Instruction &in);
+    void opSkipKeyNotPressed(const Instruction &in);
+    void opLoadDelay(const Instruction &in);
+    void opWaitKey(const Instruction &in);
+    void opSetDelay(const Instruction &in);
+    void opSetSound(const Instruction &in);
+    void opAddIndex(const Instruction &in);
+    void opLoadFont(const Instruction &in);
+    void opStoreBCD(const Instruction &in);
+    template <typename Quirks> void opStoreRegisters(const Instruction &in);
+    template <typename Quirks> void opLoadRegisters(const Instruction &in);
 
 public:
     // CHIP-8 keys on original system
-    const unsigned char chip8Keys[16] = {
+    static constexpr unsigned char chip8Keys[16] = {
         '1', '2', '3', 'C',
         '4', '5', '6', 'D',
         '7', '8', '9', 'E',
@@ -90,8 +250,35 @@ public:
     Loads the game ROM
     Args:
         - fileName: A pointer to a string containing the path of the file to load
+        - variant: Implementation the ROM was written for
+    */
+    void loadGame(std::string fileName, Variant variant = Variant::Modern);
+
+    /*
+    Loads a game ROM that is already in memory, e.g. from a preloaded corpus, and hashes it
+    on the way
+    Args:
+        - data: Contents of the ROM
+        - size: Size of the ROM in bytes; must fit below the variant's programEnd
+        - variant: Implementation the ROM was written for
+    */
+    void loadGame(const unsigned char *data, size_t size, Variant variant = Variant::Modern);
+
+    /*
+    Returns the hash of the loaded ROM
     */
-    void loadGame(std::string fileName);
+    uint64_t getRomHash();
+
+    /*
+    Returns the FNV-1a hash of a ROM's contents, which identifies the ROM in movies and reports
+    */
+    static uint64_t hashRom(const unsigned char *data, size_t size);
+
+    /*
+    Reads a whole ROM file with a single read; throws if it can't be read or is larger
+    than MAX_ROM_SIZE
+    */
+    static std::vector<unsigned char> readRom(std::string fileName);
 
     /*
     Initializes the keyboard interface
@@ -103,11 +290,58 @@ public:
     */
     void emulateCycle();
 
+    /*
+    Runs a batch of emulation cycles with the selected engine
+    Args:
+        - cycles: Number of cycles to run
+    */
+    void runCycles(int cycles);
 
     /*
-    Updates key inputs from user; saves key press to register at registerIndex if paused
+    Runs a batch of emulation cycles and ticks the delay and sound timers at
+    TIMERS_FREQUENCY in emulated time, i.e. after every clockSpeed / TIMERS_FREQUENCY
+    cycles as an exact fraction. The result doesn't depend on how the cycles are split
+    between calls; cycles spent waiting on 0xFx0A still count as elapsed time, and cost no
+    more than counting the timer ticks they span. Loops that
+    wait on the delay timer or a key, or jump to themselves, are skipped ahead to the next
+    timer tick, leaving the same state as running them
+    Args:
+        - cycles: Number of cycles to run
     */
-    void setKeys(int registerIndex);
+    void runTimed(long long cycles);
+
+    /*
+    Sets the number of cycles per second of emulated time used by runTimed(); the time
+    since the last timer tick is kept as a fraction of a tick
+    */
+    void setClockSpeed(unsigned int clockSpeed);
+    unsigned int getClockSpeed();
+
+    /*
+    Selects the engine used by runCycles(); all engines produce identical results
+    */
+    void setEngine(Engine engine);
+    Engine getEngine();
+
+    /*
+    Selects the implementation whose quirks are emulated, binding the interpreters compiled
+    for that variant
+    */
+    void setVariant(Variant variant);
+    Variant getVariant();
+
+    /*
+    Seeds the random number generator used by 0xCxkk; instances with the same seed and
+    inputs produce the same results
+    */
+    void seedRandom(uint64_t seed);
+
+    /*
+    Updates key inputs from the frontend; completes a pending 0xFx0A if a key was released
+    Args:
+        - mask: Bit i is set if CHIP-8 key i is currently held
+    */
+    void setKeyMask(unsigned short mask);
 
     /* 
     Updates delay and sound timers
@@ -134,12 +368,37 @@ public:
     */
     bool isPausedForKeyPress();
 
+    /*
+    Returns the register a pending 0xFx0A stores the released key into, or -1 if the
+    CHIP-8 isn't waiting for a key. While it waits, running cycles only advances the
+    timers, so callers can stop running it once the timers are zero and resume it when
+    setKeyMask() reports a key release
+    */
+    int getKeyWaitRegister();
+
+    /*
+    Copies the complete architectural state out of / into the CHIP-8. Loading only
+    invalidates the decoded and recompiled code for memory bytes that actually change
+    */
+    void saveState(Chip8State &state);
+    void loadState(const Chip8State &state);
+
+    /*
+    Writes / reads a save state file: a versioned header followed by the raw Chip8State
+    in host byte order
+    Args:
+        - fileName: Path of the save state file
+    */
+    void saveStateToFile(std::string fileName);
+    void loadStateFromFile(std::string fileName);
+
     /*
     Getters for all state variables
     */
     unsigned short getMemory(unsigned short i);
     unsigned char getRegister(int i);
     bool getDisplay(int i);
+    uint64_t getDisplayRow(int y);
     bool getKey(int i);
     unsigned short getStack(int i);
     unsigned short getSoundTimer();
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include "emulator.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <time.h>
+#endif
+
+// Sleeps until an absolute time rather than for a duration, so the time taken to compute
+// the deadline and get descheduled doesn't delay every wake-up
+static void sleepUntil(std::chrono::steady_clock::time_point deadline) {
+#if defined(__linux__)
+    // steady_clock is CLOCK_MONOTONIC with libstdc++ and libc++ on Linux
+    auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    timespec time;
+    time.tv_sec = sinceEpoch / 1000000000;
+    time.tv_nsec = sinceEpoch % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr) == EINTR) {}
+#else
+    std::this_thread::sleep_until(deadline);
+#endif
+}
+
+Emulator::Emulator(Chip8 *chip8, Rewind *rewind, Movie *movie, float clockSpeed)
+    : chip8(chip8), rewind(rewind), movie(movie),
+      clockSpeed(movie ? movie->getCyclesPerFrame() * TIMERS_FREQUENCY : clockSpeed) {
+    // The reader sees a complete frame even before the thread has run one
+    publish();
+    frames.read();
+}
+
+Emulator::~Emulator() {
+    stop();
+}
+
+void Emulator::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    scheduler.reset();
+    thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::stop() {
+    running = false;
+    wake();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Emulator::run() {
+    // Frames start on absolute deadlines, so time spent running a frame doesn't add up
+    // into drift; the scheduler still measures the real time elapsed between frames
+    const auto framePeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / TIMERS_FREQUENCY));
+    auto deadline = std::chrono::steady_clock::now();
+    sampleTime = deadline;
+
+    while (running) {
+        deadline += framePeriod;
+        runFrame(deadline);
+        publish();
+
+        // Nothing happens while paused, or while the ROM waits on 0xFx0A with the timers
+        // stopped, so sleep until the GUI asks for something or sends a key instead of
+        // waking up every frame. The time spent waiting isn't emulated; only the phase of
+        // the next timer tick could tell
+        if ((chip8->isPaused() || isSuspended()) && !rewindHeld) {
+            std::unique_lock<std::mutex> lock(commandMutex);
+            wakeCondition.wait(lock, [this] { return wakeRequested || !commands.empty(); });
+            wakeRequested = false;
+            lock.unlock();
+            scheduler.reset();
+            deadline = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        // After a stall, start counting from now rather than running frames back to back
+        if (deadline < now) {
+            deadline = now;
+        }
+        sleepUntil(deadline);
+    }
+}
+
+void Emulator::wake() {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        wakeRequested = true;
+    }
+    wakeCondition.notify_one();
+}
+
+void Emulator::runFrame(std::chrono::steady_clock::time_point deadline) {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        runningCommands.swap(commands);
+    }
+    for (std::function<void()> &command : runningCommands) {
+        command();
+    }
+    runningCommands.clear();
+
+    // Step back one recorded frame per frame while the rewind key is held; disabled while
+    // recording a movie, which only captures key presses
+    if (!movie && rewindHeld) {
+        if (rewind->seek(rewind->getPosition() - 1, snapshot)) {
+            chip8->loadState(snapshot);
+        }
+        scheduler.reset();
+        applyKeyEvents(0, true);
+        chip8->setKeyMask(keyMask); // The loaded state holds the keys of its own frame
+    }
+    // In turbo mode, run batches of whole emulated frames until this frame's deadline; only
+    // the last one is shown. Reading the clock and the key events costs as much as a few
+    // frames, so they are checked once per batch, and key events go in at the start of the
+    // batch after they arrive
+    else if (!chip8->isPaused() && turbo) {
+        chip8->setClockSpeed((unsigned int) (clockSpeed + 0.5f));
+        int frameCycles = std::max(1u, chip8->getClockSpeed() / TIMERS_FREQUENCY);
+        auto now = std::chrono::steady_clock::now();
+        do {
+            auto batchStart = now;
+            scheduler.reset();
+            runBatch(frameCycles * turboFrames);
+            now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - batchStart).count();
+            if (seconds < TURBO_CHECK_INTERVAL / 2 && turboFrames < INT_MAX / 2 / frameCycles) {
+                turboFrames *= 2;
+            }
+            else if (seconds > TURBO_CHECK_INTERVAL * 2 && turboFrames > 1) {
+                turboFrames /= 2;
+            }
+        } while (now < deadline && !isSuspended());
+        scheduler.reset();
+
+        chip8->saveState(snapshot);
+        rewind->record(snapshot);
+    }
+    // Run every cycle that became due since the last frame in one batch; the timers tick
+    // according to the cycles run, not the host time
+    else if (!chip8->isPaused()) {
+        chip8->setClockSpeed((unsigned int) (clockSpeed + 0.5f));
+        scheduler.beginFrame(chip8->getClockSpeed() * speedMultiplier);
+        runBatch(scheduler.getCyclesDue());
+
+        chip8->saveState(snapshot);
+        rewind->record(snapshot);
+    }
+    else {
+        scheduler.reset();
+        applyKeyEvents(0, true);
+    }
+}
+
+bool Emulator::isSuspended() {
+    return !movie && chip8->getKeyWaitRegister() >= 0 && chip8->getDelayTimer() == 0 && chip8->getSoundTimer() == 0;
+}
+
+void Emulator::runBatch(int cycles) {
+    if (movie) {
+        // Movies advance in whole frames of a fixed number of cycles, each with the key
+        // mask at its start
+        int cyclesDone = 0;
+        pendingMovieCycles += cycles;
+        while (pendingMovieCycles >= movie->getCyclesPerFrame()) {
+            moviePresses = 0;
+            applyKeyEvents(cyclesDone, false);
+            movie->recordFrame(*chip8, keyMask);
+            pendingMovieCycles -= movie->getCyclesPerFrame();
+            cyclesDone += movie->getCyclesPerFrame();
+        }
+    }
+    else {
+        runCycles(0, cycles);
+    }
+    cyclesRun += cycles;
+}
+
+void Emulator::applyKeyEvents(int cycle, bool updateMachine) {
+    KeyEvent event;
+    while (keyEvents.peek(event)) {
+        int eventCycle = scheduler.getCycleAt(event.time);
+        if (eventCycle < 0 || eventCycle > cycle) {
+            break;
+        }
+        if (!updateMachine && !event.pressed && (moviePresses & (1 << event.key))) {
+            break;
+        }
+        if (event.pressed) {
+            moviePresses |= 1 << event.key;
+            keyMask |= 1 << event.key;
+        }
+        else {
+            keyMask &= ~(1 << event.key);
+        }
+        if (updateMachine) {
+            chip8->setKeyMask(keyMask);
+        }
+        keyEvents.pop();
+    }
+}
+
+void Emulator::runCycles(int from, int to) {
+    KeyEvent event;
+    while (keyEvents.peek(event)) {
+        int eventCycle = scheduler.getCycleAt(event.time);
+        if (eventCycle < 0 || eventCycle > to) {
+            break;
+        }
+        // Times from the GUI thread aren't strictly increasing, so never step backwards
+        if (eventCycle > from) {
+            chip8->runTimed(eventCycle - from);
+            from = eventCycle;
+        }
+        applyKeyEvents(from, true);
+    }
+    chip8->runTimed(to - from);
+}
+
+void Emulator::publish() {
+    EmulatorFrame &frame = frames.getBack();
+    chip8->saveState(frame.state);
+    frame.paused = chip8->isPaused();
+    frame.engine = chip8->getEngine();
+    frame.variant = chip8->getVariant();
+    frame.rewindPosition = rewind->getPosition();
+    frame.rewindFrameCount = rewind->getFrameCount();
+    frame.rewindBytesUsed = rewind->getBytesUsed();
+    frame.hasSavedState = hasSavedState;
+    frame.recording = movie != nullptr;
+
+    auto now = std::chrono::steady_clock::now();
+    double sampleSeconds = std::chrono::duration<double>(now - sampleTime).count();
+    if (sampleSeconds >= SPEED_SAMPLE_INTERVAL) {
+        instructionsPerSecond = (cyclesRun - sampleCycles) / sampleSeconds;
+        sampleCycles = cyclesRun;
+        sampleTime = now;
+    }
+    frame.instructionsPerSecond = instructionsPerSecond;
+    frame.speed = instructionsPerSecond / chip8->getClockSpeed();
+    frames.publish();
+}
+
+const EmulatorFrame &Emulator::readFrame() {
+    return frames.read();
+}
+
+void Emulator::post(std::function<void()> command) {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        commands.push_back(std::move(command));
+    }
+    wakeCondition.notify_one();
+}
+
+void Emulator::setClockSpeed(float clockSpeed) {
+    if (movie) {
+        return;
+    }
+    this->clockSpeed = clockSpeed;
+}
+
+void Emulator::pushKeyEvent(int key, bool pressed, std::chrono::steady_clock::time_point time) {
+    keyEvents.push({time, (unsigned char) key, pressed});
+    wake();
+}
+
+void Emulator::setSpeed(float multiplier, bool turbo) {
+    speedMultiplier = multiplier;
+    this->turbo = turbo;
+}
+
+void Emulator::setRewindHeld(bool held) {
+    if (rewindHeld.exchange(held) != held) {
+        wake();
+    }
+}
+
+void Emulator::togglePaused() {
+    post([this] { chip8->togglePaused(); });
+}
+
+void Emulator::forwardOneCycle() {
+    if (movie) {
+        return;
+    }
+    post([this] {
+        chip8->setKeyMask(keyMask);
+        chip8->runTimed(1);
+    });
+}
+
+void Emulator::setEngine(Engine engine) {
+    post([this, engine] { chip8->setEngine(engine); });
+}
+
+void Emulator::setVariant(Variant variant) {
+    if (movie) {
+        return;
+    }
+    post([this, variant] { chip8->setVariant(variant); });
+}
+
+void Emulator::saveState() {
+    post([this] {
+        chip8->saveState(savedState);
+        hasSavedState = true;
+    });
+}
+
+void Emulator::loadState() {
+    if (movie) {
+        return;
+    }
+    post([this] {
+        if (hasSavedState) {
+            chip8->loadState(savedState);
+        }
+    });
+}
+
+void Emulator::seekRewind(int frame) {
+    // Dragging the slider pauses on the chosen frame, and resuming discards the frames after it
+    if (movie) {
+        return;
+    }
+    post([this, frame] {
+        Chip8State state;
+        if (rewind->seek(frame, state)) {
+            if (!chip8->isPaused()) {
+                chip8->togglePaused();
+            }
+            chip8->loadState(state);
+        }
+    });
+}
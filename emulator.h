@@ -0,0 +1,224 @@
+/*
+Runs a Chip 8 on its own thread at a steady 60 Hz frame rate, independent of how long the
+GUI takes to draw, and publishes a snapshot of the machine after every frame
+*/
+
+#ifndef EMULATOR_H_INCLUDED
+#define EMULATOR_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "movie.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "spsc_ring.h"
+#include "triple_buffer.h"
+
+#define KEY_EVENT_CAPACITY 1024 // Key transitions queued between frames; later ones are dropped
+#define SPEED_SAMPLE_INTERVAL 0.5 // Seconds between updates of the measured emulation speed
+#define TURBO_CHECK_INTERVAL 0.001 // Seconds of emulation in turbo mode between checks of the clock
+
+// A CHIP-8 key being pressed or released, stamped with the host time it happened
+struct KeyEvent {
+    std::chrono::steady_clock::time_point time;
+    unsigned char key;
+    bool pressed;
+};
+
+// Everything the GUI shows about the emulator, copied out at the end of each frame
+struct EmulatorFrame {
+    Chip8State state;
+    bool paused = false;
+    Engine engine = Engine::Interpreter;
+    Variant variant = Variant::Modern;
+    int rewindPosition = 0;
+    int rewindFrameCount = 0;
+    size_t rewindBytesUsed = 0;
+    bool hasSavedState = false;
+    bool recording = false; // True while recording a movie
+    // Emulated cycles per host second, and emulated seconds per host second
+    double instructionsPerSecond = 0;
+    double speed = 0;
+};
+
+class Emulator {
+private:
+    Chip8 *chip8;
+    Rewind *rewind;
+    Movie *movie; // Null unless recording
+    Scheduler scheduler;
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    // Set by the GUI thread, read by the emulation thread once per frame
+    std::atomic<float> clockSpeed;
+    std::atomic<float> speedMultiplier{1};
+    std::atomic<bool> turbo{false};
+    // Emulated frames turbo mode runs between checks of the clock; adjusted so that a
+    // batch takes about TURBO_CHECK_INTERVAL
+    int turboFrames = 1;
+    std::atomic<bool> rewindHeld{false};
+
+    // Emulated cycles run in total, and at the start of the current speed sample
+    long long cyclesRun = 0;
+    long long sampleCycles = 0;
+    std::chrono::steady_clock::time_point sampleTime;
+    double instructionsPerSecond = 0;
+
+    // Key transitions from the GUI thread, and the keys they leave held on the emulation
+    // thread. Each event is applied at the cycle of the frame that matches its time
+    SpscRing<KeyEvent, KEY_EVENT_CAPACITY> keyEvents;
+    unsigned short keyMask = 0;
+    // Keys pressed during the movie frame being gathered; their releases wait for the next
+    // frame, as a movie holds one key mask per frame
+    unsigned short moviePresses = 0;
+
+    // Actions from the GUI, run on the emulation thread before its next frame; the mutex only
+    // guards the vector, so posting never waits for a frame to finish
+    std::mutex commandMutex;
+    std::vector<std::function<void()>> commands;
+    std::vector<std::function<void()>> runningCommands;
+    // While paused or waiting on a key the thread sleeps on wakeCondition until a command,
+    // key event or change of the rewind key sets wakeRequested; both are guarded by
+    // commandMutex
+    std::condition_variable wakeCondition;
+    bool wakeRequested = false;
+
+    TripleBuffer<EmulatorFrame> frames;
+    Chip8State snapshot; // Scratch state for the rewind buffer
+    // Cycles due but not yet run while recording a movie, which advances in whole frames
+    int pendingMovieCycles = 0;
+    // In-memory save slot used by the Save/Load buttons
+    Chip8State savedState;
+    bool hasSavedState = false;
+
+    /*
+    Emulation thread; runs frames until stop() is called
+    */
+    void run();
+
+    /*
+    Wakes the emulation thread if it is sleeping while paused
+    */
+    void wake();
+
+    /*
+    Runs the commands posted since the last frame and then one frame of emulation
+    Args:
+        - deadline: When the frame ends; in turbo mode emulation runs until then
+    */
+    void runFrame(std::chrono::steady_clock::time_point deadline);
+
+    /*
+    Check if the ROM waits on 0xFx0A with both timers stopped, so that nothing changes
+    until a key is released. Never true while recording a movie, which only passes keys to
+    the machine at whole frames and keeps recording frames during the wait
+    */
+    bool isSuspended();
+
+    /*
+    Runs a batch of cycles, applying key events at their cycles of the scheduler's current
+    frame, and recording them into the movie if there is one
+    */
+    void runBatch(int cycles);
+
+    /*
+    Updates the held keys with the events that take effect at or before the given cycle of
+    the scheduler's current frame
+    Args:
+        - cycle: Last cycle whose events are applied
+        - updateMachine: If true, the machine sees each event separately, so a press and
+          release within the same cycle still completes a 0xFx0A. If false, the keys are
+          gathered for a movie frame, and a release of a key pressed within it stops the
+          events there, so each press is held for at least one frame
+    */
+    void applyKeyEvents(int cycle, bool updateMachine);
+
+    /*
+    Runs the cycles of the current frame from cycle from up to cycle to, applying key
+    events at their cycles on the way
+    */
+    void runCycles(int from, int to);
+
+    /*
+    Copies the machine into the back buffer and publishes it
+    */
+    void publish();
+
+    /*
+    Queues an action for the emulation thread
+    */
+    void post(std::function<void()> command);
+
+public:
+    /*
+    Args:
+        - chip8: Machine to run, with its game loaded
+        - rewind: History recorded after every frame and stepped back through while the
+          rewind key is held
+        - movie: Movie to record every frame into, or null
+        - clockSpeed: Initial clock speed in Hertz
+    */
+    Emulator(Chip8 *chip8, Rewind *rewind, Movie *movie, float clockSpeed);
+    ~Emulator();
+
+    /*
+    Starts and stops the emulation thread; the machine must not be touched directly while
+    it runs
+    */
+    void start();
+    void stop();
+
+    /*
+    Returns the latest published frame without blocking; only one thread may read frames.
+    The reference stays valid until the next call
+    */
+    const EmulatorFrame &readFrame();
+
+    /*
+    Inputs sampled by the GUI; they take effect from the next frame. While recording a movie
+    the clock speed stays at the movie's cyclesPerFrame * 60
+    */
+    void setClockSpeed(float clockSpeed);
+    void setRewindHeld(bool held);
+
+    /*
+    Sets how fast emulated time runs compared to real time
+    Args:
+        - multiplier: Emulated seconds per real second when not in turbo mode
+        - turbo: If true, runs as many cycles as the host allows; the GUI is still sent
+          one frame per 1/60 s of real time
+    */
+    void setSpeed(float multiplier, bool turbo);
+
+    /*
+    Queues a key transition; called by the GUI thread only. It takes effect at the emulated
+    cycle matching its time, or, if that has already run, at the start of the next frame
+    Args:
+        - key: CHIP-8 key, 0x0 to 0xF
+        - pressed: True if the key went down, false if it was released
+        - time: Host time the transition happened
+    */
+    void pushKeyEvent(int key, bool pressed, std::chrono::steady_clock::time_point time);
+
+    /*
+    Controls from the GUI; each runs on the emulation thread before its next frame. While
+    recording a movie, which only holds key presses, forwardOneCycle(), loadState(),
+    seekRewind() and setVariant() are ignored, as the movie couldn't replay them
+    */
+    void togglePaused();
+    void forwardOneCycle();
+    void setEngine(Engine engine);
+    void setVariant(Variant variant);
+    void saveState();
+    void loadState();
+    void seekRewind(int frame);
+};
+
+#endif
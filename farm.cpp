@@ -0,0 +1,308 @@
+/*
+Runs a list of ROM jobs headless across all cores and writes a JSON report with the final
+framebuffer hash, a PBM screenshot and the speed of each job
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "movie.h"
+#include "rom_pack.h"
+
+#define FARM_CLOCK_SPEED 500 // Emulated clock speed in Hertz for jobs without a movie
+
+// One line of the jobs file: <rom> <frames> [seed] [movie]
+struct Job {
+    std::string rom; // File name, or with a ROM pack a name or hash in the pack
+    long long frames = 0;
+    uint64_t seed = 0;
+    std::string movie; // Empty if the job runs without input; a movie also sets the variant and seed
+};
+
+struct JobResult {
+    uint64_t hash = 0;
+    std::string screenshot;
+    long long cycles = 0;
+    double seconds = 0;
+    std::string error; // Empty if the job ran
+};
+
+// Fixed set of workers, each with its own queue of job indices. A worker takes jobs from
+// the back of its own queue and, once that is empty, steals from the front of the others',
+// so a few long jobs don't leave cores idle while the rest wait
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> jobs;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    bool pop(int worker, int &job) {
+        Queue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.jobs.empty()) {
+            return false;
+        }
+        job = own.jobs.back();
+        own.jobs.pop_back();
+        return true;
+    }
+
+    bool steal(int worker, int &job) {
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue &victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    WorkStealingPool(int workers) {
+        for (int i = 0; i < workers; i++) {
+            queues.emplace_back(new Queue());
+        }
+    }
+
+    /*
+    Runs task(job) for every job in [0, jobCount) and returns once all have finished
+    */
+    template <typename Task>
+    void run(int jobCount, Task task) {
+        // Deal the jobs out round-robin; no new jobs are added while workers run
+        for (int i = 0; i < jobCount; i++) {
+            queues[i % queues.size()]->jobs.push_back(i);
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < queues.size(); worker++) {
+            threads.emplace_back([this, worker, &task] {
+                int job;
+                while (pop(worker, job) || steal(worker, job)) {
+                    task(job);
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+// Parses a seed written as a decimal number that fits in 64 bits
+static bool parseSeed(const std::string &text, uint64_t &seed) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    try {
+        seed = std::stoull(text);
+    } catch(std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+static std::vector<Job> readJobs(std::string fileName) {
+    std::ifstream fin(fileName);
+    if (!fin.is_open()) {
+        throw Chip8::InitializationError("Unable to open jobs file");
+    }
+
+    std::vector<Job> jobs;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(fin, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        Job job;
+        // The optional fields are read as text so that one that is present but malformed,
+        // e.g. a movie given without a seed, is reported rather than silently dropped
+        std::string seed, extra;
+        if (!(fields >> job.rom >> job.frames) || job.frames < 0 ||
+            ((fields >> seed) && !parseSeed(seed, job.seed)) ||
+            ((fields >> job.movie) && (fields >> extra))) {
+            throw std::invalid_argument("Malformed job on line " + std::to_string(lineNumber));
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Loads a job's ROM from the pack if there is one, otherwise from its file
+static void loadRom(Chip8 &chip8, const Job &job, RomPack *pack, Variant variant) {
+    if (!pack) {
+        chip8.loadGame(job.rom, variant);
+        return;
+    }
+    PackedRom rom;
+    if (!pack->find(job.rom, rom)) {
+        throw std::invalid_argument("No ROM " + job.rom + " in the pack");
+    }
+    chip8.loadGame(rom.data, rom.size, variant);
+}
+
+static JobResult runJob(const Job &job, int index, RomPack *pack, const std::filesystem::path &outputDirectory) {
+    JobResult result;
+    Chip8 chip8;
+    chip8.setEngine(Engine::Threaded);
+
+    std::unique_ptr<Movie> movie;
+    if (!job.movie.empty()) {
+        movie.reset(new Movie(job.movie));
+        loadRom(chip8, job, pack, movie->getVariant());
+        if (chip8.getRomHash() != movie->getRomHash()) {
+            throw std::invalid_argument("Movie was recorded with a different ROM");
+        }
+        movie->begin(chip8);
+    }
+    else {
+        loadRom(chip8, job, pack, Variant::Modern);
+        chip8.seedRandom(job.seed);
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    long long frame = 0;
+    if (movie) {
+        while (frame < job.frames && movie->playFrame(chip8)) {
+            frame++;
+        }
+        result.cycles = frame * movie->getCyclesPerFrame();
+    }
+    // Frames past the end of the movie, or all of them without one, run in one go with no
+    // keys held; the timers still tick every 1/60 s of emulated time
+    unsigned int clockSpeed = movie ? movie->getCyclesPerFrame() * TIMERS_FREQUENCY : FARM_CLOCK_SPEED;
+    long long remainingCycles = (job.frames - frame) * clockSpeed / TIMERS_FREQUENCY;
+    chip8.setKeyMask(0);
+    chip8.setClockSpeed(clockSpeed);
+    chip8.runTimed(remainingCycles);
+    result.cycles += remainingCycles;
+    result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    // FNV-1a over the rows, and a binary PBM of the rows inverted, since PBM draws 1 bits
+    // black and the display draws lit pixels white on black
+    result.hash = 0xCBF29CE484222325ULL;
+    std::string pixels;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint64_t row = chip8.getDisplayRow(y);
+        for (int byte = 7; byte >= 0; byte--) {
+            unsigned char bits = (row >> (byte * 8)) & 0xFF;
+            result.hash = (result.hash ^ bits) * 0x100000001B3ULL;
+            pixels.push_back(~bits);
+        }
+    }
+    std::filesystem::path screenshot = outputDirectory /
+        (std::to_string(index) + "-" + std::filesystem::path(job.rom).stem().string() + ".pbm");
+    std::ofstream fout(screenshot, std::ios::binary);
+    fout << "P4\n" << SCREEN_WIDTH << " " << SCREEN_HEIGHT << "\n" << pixels;
+    if (!fout) {
+        throw std::runtime_error("Unable to write " + screenshot.string());
+    }
+    result.screenshot = screenshot.string();
+    return result;
+}
+
+static std::string jsonString(const std::string &text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+int main(int argc, char **argv) {
+    try {
+        // With --pack, every ROM comes from one memory-mapped pack instead of its own file
+        std::unique_ptr<RomPack> pack;
+        if (argc >= 3 && std::string(argv[1]) == "--pack") {
+            pack.reset(new RomPack(argv[2]));
+            argc -= 2;
+            argv += 2;
+        }
+        if (argc != 3 && argc != 4) {
+            throw std::invalid_argument("Usage: chip8-farm [--pack <pack-file>] <jobs-file> <output-directory> [threads]");
+        }
+        std::vector<Job> jobs = readJobs(argv[1]);
+        std::filesystem::path outputDirectory = argv[2];
+        std::filesystem::create_directories(outputDirectory);
+        int threads = argc == 4 ? atoi(argv[3]) : (int) std::thread::hardware_concurrency();
+        if (threads < 1) {
+            threads = 1;
+        }
+
+        std::vector<JobResult> results(jobs.size());
+        std::atomic<int> failures(0);
+        auto startTime = std::chrono::high_resolution_clock::now();
+        WorkStealingPool pool(threads);
+        pool.run(jobs.size(), [&](int i) {
+            try {
+                results[i] = runJob(jobs[i], i, pack.get(), outputDirectory);
+            } catch(std::exception& e) {
+                results[i].error = e.what();
+                failures++;
+            }
+        });
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        long long totalCycles = 0;
+        std::ofstream report(outputDirectory / "report.json");
+        report << "{\n  \"threads\": " << threads << ",\n  \"jobs\": [\n";
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const Job &job = jobs[i];
+            const JobResult &result = results[i];
+            char hash[17];
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) result.hash);
+            report << "    {\"rom\": " << jsonString(job.rom) << ", \"frames\": " << job.frames
+                   << ", \"seed\": " << job.seed << ", \"movie\": " << (job.movie.empty() ? "null" : jsonString(job.movie));
+            if (result.error.empty()) {
+                report << ", \"hash\": \"" << hash << "\", \"screenshot\": " << jsonString(result.screenshot)
+                       << ", \"cycles\": " << result.cycles << ", \"seconds\": " << result.seconds
+                       << ", \"ips\": " << (result.seconds > 0 ? result.cycles / result.seconds : 0);
+            }
+            else {
+                report << ", \"error\": " << jsonString(result.error);
+            }
+            report << "}" << (i + 1 < jobs.size() ? "," : "") << "\n";
+            totalCycles += result.cycles;
+        }
+        report << "  ],\n  \"seconds\": " << seconds << ",\n  \"ips\": " << (seconds > 0 ? totalCycles / seconds : 0) << "\n}\n";
+        if (!report) {
+            throw std::runtime_error("Unable to write report");
+        }
+
+        std::cout << jobs.size() << " jobs on " << threads << " threads in " << seconds << " s ("
+                  << totalCycles / seconds / 1e6 << " MIPS), " << failures << " failed" << std::endl;
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -3,6 +3,8 @@
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_sdlrenderer.h"
 #include <stdio.h>
+#include <chrono>
+#include <cstring>
 #include <SDL.h>
 #include <string>
 #include <sstream>
@@ -11,9 +13,10 @@
 #define TEXT_LABEL_COLOR IM_COL32(255, 0, 0, 255)
 #define GREEN_COLOR IM_COL32(0, 255, 0, 255)
 #define YELLOW_COLOR IM_COL32(255, 255, 0, 255)
+#define CYAN_COLOR IM_COL32(0, 255, 255, 255)
 
-GUI::GUI(Chip8 *chip8) {
-    this->chip8 = chip8;
+GUI::GUI(Emulator *emulator) {
+    this->emulator = emulator;
     // Setup SDL
     if (SDL_Init(SDL_INIT_VIDEO) != 0) { throw Chip8::InitializationError(SDL_GetError()); }
 
@@ -22,6 +25,10 @@ GUI::GUI(Chip8 *chip8) {
 
     int COMPUTER_SCREEN_WIDTH = DM.w;
     int COMPUTER_SCREEN_HEIGHT = DM.h;
+    refreshPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / (DM.refresh_rate > 0 ? DM.refresh_rate : 60)));
+    nextFrameTime = lastActivityTime = lastCpuSampleTime = std::chrono::steady_clock::now();
+    lastCpuTime = std::clock();
 
     // Create window with SDL_Renderer graphics context
     window = SDL_CreateWindow("CHIP8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
@@ -41,6 +48,17 @@ GUI::GUI(Chip8 *chip8) {
     // Setup Platform/Renderer backends
     ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
     ImGui_ImplSDLRenderer_Init(renderer);
+
+    // Screen texture, scaled up without filtering so pixels stay sharp
+    displayTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                       SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (displayTexture == nullptr) { throw Chip8::InitializationError(SDL_GetError()); }
+    SDL_SetTextureScaleMode(displayTexture, SDL_ScaleModeNearest);
+    for (int byte = 0; byte < 256; byte++) {
+        for (int bit = 0; bit < 8; bit++) {
+            pixelLookup[byte][bit] = (byte & (0x80 >> bit)) ? 0xFFFFFFFF : 0xFF000000;
+        }
+    }
 }
 
 GUI::~GUI() {
@@ -49,6 +67,7 @@ GUI::~GUI() {
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 
+    SDL_DestroyTexture(displayTexture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -60,8 +79,10 @@ void GUI::renderGUI(float &clockSpeed) {
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
 
-    // Create widgets
-    createWidgets(clockSpeed);
+    // Create widgets from the latest frame the emulation thread finished
+    const EmulatorFrame &frame = emulator->readFrame();
+    emulatorRunning = !frame.paused;
+    createWidgets(frame, clockSpeed);
 
     // Render
     ImGui::Render();
@@ -70,6 +91,73 @@ void GUI::renderGUI(float &clockSpeed) {
     SDL_RenderClear(renderer);
     ImGui_ImplSDLRenderer_RenderDrawData(ImGui::GetDrawData());
     SDL_RenderPresent(renderer); // SLOW
+
+    // Schedule the next frame from this one's deadline, so the rate doesn't drift; after
+    // a stall, count from now instead of drawing frames back to back
+    auto now = std::chrono::steady_clock::now();
+    bool active = emulatorRunning || isRewindHeld() ||
+                  now - lastActivityTime < std::chrono::duration<double>(GUI_ACTIVE_TIME);
+    if (active) {
+        nextFrameTime += refreshPeriod;
+    }
+    else {
+        nextFrameTime = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(GUI_IDLE_FRAME_INTERVAL));
+    }
+    if (nextFrameTime < now) {
+        nextFrameTime = now;
+    }
+
+    double sampleSeconds = std::chrono::duration<double>(now - lastCpuSampleTime).count();
+    if (sampleSeconds >= CPU_USAGE_INTERVAL) {
+        std::clock_t cpuTime = std::clock();
+        cpuUsage = 100.0 * (cpuTime - lastCpuTime) / CLOCKS_PER_SEC / sampleSeconds;
+        lastCpuTime = cpuTime;
+        lastCpuSampleTime = now;
+    }
+}
+
+bool GUI::waitEvent(SDL_Event &e) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        nextFrameTime - std::chrono::steady_clock::now()).count();
+    // Once the frame is due, only take the events already queued
+    if (remaining <= 0 ? SDL_PollEvent(&e) == 1 : SDL_WaitEventTimeout(&e, (int) remaining) == 1) {
+        auto now = std::chrono::steady_clock::now();
+        // Input makes ImGui redraw, so go back to full rate until things settle
+        if (now - lastActivityTime >= std::chrono::duration<double>(GUI_ACTIVE_TIME)) {
+            nextFrameTime = now;
+        }
+        lastActivityTime = now;
+        return true;
+    }
+    return false;
+}
+
+void GUI::updateDisplayTexture(const uint64_t *display) {
+    bool changed = !displayUploaded;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint64_t row = display[y];
+        changed |= row != uploadedDisplay[y];
+        uploadedDisplay[y] = row;
+    }
+    if (!changed) {
+        return;
+    }
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(displayTexture, nullptr, &pixels, &pitch) != 0) {
+        return;
+    }
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint32_t *out = (uint32_t *) ((unsigned char *) pixels + y * pitch);
+        // Expand the row a byte, i.e. 8 pixels, at a time; bit 63 is the leftmost pixel
+        for (int byte = 0; byte < SCREEN_WIDTH / 8; byte++) {
+            memcpy(out + byte * 8, pixelLookup[(uploadedDisplay[y] >> (56 - byte * 8)) & 0xFF], 8 * sizeof(uint32_t));
+        }
+    }
+    SDL_UnlockTexture(displayTexture);
+    displayUploaded = true;
 }
 
 // Converts c from hexadecimal to int
@@ -80,7 +168,7 @@ int hexToInt(char c) {
     return c - '0';
 }
 
-inline void GUI::createWidgets(float &clockSpeed) {
+inline void GUI::createWidgets(const EmulatorFrame &frame, float &clockSpeed) {
     const int WINDOW_WIDTH = io->DisplaySize.x;
     const int WINDOW_HEIGHT = io->DisplaySize.y;
 
@@ -104,7 +192,7 @@ inline void GUI::createWidgets(float &clockSpeed) {
             ImGui::Text("SP");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            ImGui::Text("%X", chip8->getStackPointer());
+            ImGui::Text("%X", frame.state.stackPointer);
             ImGui::Text(""); // Newline
 
             for (int i = 0; i < 16; i++) {
@@ -112,9 +200,9 @@ inline void GUI::createWidgets(float &clockSpeed) {
                 ImGui::Text("%X", i);
                 ImGui::SameLine();
                 ImGui::PopStyleColor();
-                ImGui::Text("0x%X", chip8->getStack(i));
+                ImGui::Text("0x%X", frame.state.stack[i]);
                 // Draw arrow on topmost stack element
-                if (i == chip8->getStackPointer() - 1) {
+                if (i == frame.state.stackPointer - 1) {
                     ImGui::SameLine();
                     ImGui::Text(" <");
                 }
@@ -145,7 +233,7 @@ inline void GUI::createWidgets(float &clockSpeed) {
 
                 for (int i = 0; i < 8; i++) {
                     ImGui::TableNextColumn();
-                    ImGui::Text("%d", chip8->getRegister(i));
+                    ImGui::Text("%d", frame.state.registers[i]);
                 }
 
                 ImGui::EndTable();
@@ -164,7 +252,7 @@ inline void GUI::createWidgets(float &clockSpeed) {
                 
                 for (int i = 8; i < 16; i++) {
                     ImGui::TableNextColumn();
-                    ImGui::Text("%d", chip8->getRegister(i));
+                    ImGui::Text("%d", frame.state.registers[i]);
                 }
                 
                 ImGui::EndTable();
@@ -177,7 +265,7 @@ inline void GUI::createWidgets(float &clockSpeed) {
             ImGui::Text("PC:");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            ImGui::Text("0x%X", chip8->getProgramCounter());
+            ImGui::Text("0x%X", frame.state.programCounter);
             ImGui::SameLine();
 
             ImGui::SetCursorPosX(INFO_WIDTH / 2);
@@ -185,13 +273,13 @@ inline void GUI::createWidgets(float &clockSpeed) {
             ImGui::Text("DT:");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            ImGui::Text("%d", chip8->getDelayTimer());
+            ImGui::Text("%d", frame.state.delayTimer);
 
             ImGui::PushStyleColor(ImGuiCol_Text, YELLOW_COLOR);
             ImGui::Text("I:");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            ImGui::Text("0x%X", chip8->getIndex());
+            ImGui::Text("0x%X", frame.state.index);
             ImGui::SameLine();
 
             ImGui::SetCursorPosX(INFO_WIDTH / 2);
@@ -199,14 +287,14 @@ inline void GUI::createWidgets(float &clockSpeed) {
             ImGui::Text("ST:");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            ImGui::Text("%d", chip8->getSoundTimer());
+            ImGui::Text("%d", frame.state.soundTimer);
 
             ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
             ImGui::Text("OP:");
             ImGui::SameLine();
             ImGui::PopStyleColor();
-            unsigned short currentOpcode = chip8->getMemory(chip8->getProgramCounter()) << 8 | 
-                                           chip8->getMemory(1 + chip8->getProgramCounter());
+            unsigned short currentOpcode = frame.state.memory[frame.state.programCounter & 0xFFF] << 8 |
+                                           frame.state.memory[(frame.state.programCounter + 1) & 0xFFF];
             ImGui::Text("0x%X", currentOpcode);
 
             ImGui::End();
@@ -219,36 +307,75 @@ inline void GUI::createWidgets(float &clockSpeed) {
         bool memoryDisplay = true;
         ImGuiWindowFlags flags = ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoResize;
         if (ImGui::Begin("Memory", &memoryDisplay, flags)) {
-            for (int i = 0; i < 4096; i++) {
-                unsigned short opcode = chip8->getMemory(i);
-                // Color memory address green if programCounter is on it
-                if (i == chip8->getProgramCounter()) {
-                    ImGui::PushStyleColor(ImGuiCol_Text, GREEN_COLOR);
-                }
-                // Color memory address yellow if index is on it
-                else if (i == chip8->getIndex()) {
-                    ImGui::PushStyleColor(ImGuiCol_Text, YELLOW_COLOR);
+            const int BYTES_PER_ROW = 16;
+            const int ROWS = 4096 / BYTES_PER_ROW;
+            const unsigned short programCounter = frame.state.programCounter & 0xFFF;
+            const unsigned short index = frame.state.index & 0xFFF;
+
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("Follow:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            ImGui::Combo("##follow", &memoryFollow, "None\0PC\0I\0");
+
+            if (!shownMemorySeeded) {
+                memcpy(shownMemory, frame.state.memory, sizeof(shownMemory));
+                shownMemorySeeded = true;
+            }
+
+            if (ImGui::BeginChild("##hex")) {
+                const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+                // Scroll only when the followed address moves to another row, so the view can
+                // still be scrolled by hand
+                if (memoryFollow != 0) {
+                    int row = (memoryFollow == 1 ? programCounter : index) / BYTES_PER_ROW;
+                    if (row != followedRow) {
+                        ImGui::SetScrollY(row * rowHeight - ImGui::GetWindowHeight() / 3);
+                        followedRow = row;
+                    }
                 }
                 else {
-                    ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+                    followedRow = -1;
                 }
-                ImGui::Text("0x%04X ", i);
-                ImGui::PopStyleColor();
-                ImGui::SameLine();
-                ImGui::Text("%02X", (opcode & 0xF000) >> 12);
-                ImGui::SameLine();
-                ImGui::Text("%02X", (opcode & 0x0F00) >> 8);
-                ImGui::SameLine();
-                ImGui::Text("%02X", (opcode & 0x00F0) >> 4);
-                ImGui::SameLine();
-                ImGui::Text("%02X", opcode & 0x000F);
-                // Make two memory locations appear on same line
-                if (i % 2 == 0) {
-                    ImGui::SameLine();
-                    ImGui::Text("\t");
-                    ImGui::SameLine();
+
+                // Only the visible rows are formatted
+                ImGuiListClipper clipper;
+                clipper.Begin(ROWS, rowHeight);
+                while (clipper.Step()) {
+                    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                        ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+                        ImGui::Text("0x%03X", row * BYTES_PER_ROW);
+                        ImGui::PopStyleColor();
+                        for (int column = 0; column < BYTES_PER_ROW; column++) {
+                            int address = row * BYTES_PER_ROW + column;
+                            unsigned char value = frame.state.memory[address];
+                            // Green for the instruction at PC, yellow at I, cyan where the byte
+                            // changed since it was last shown
+                            ImU32 color = 0;
+                            if (address == programCounter || address == ((programCounter + 1) & 0xFFF)) {
+                                color = GREEN_COLOR;
+                            }
+                            else if (address == index) {
+                                color = YELLOW_COLOR;
+                            }
+                            else if (value != shownMemory[address]) {
+                                color = CYAN_COLOR;
+                            }
+                            shownMemory[address] = value;
+
+                            ImGui::SameLine();
+                            if (color != 0) {
+                                ImGui::PushStyleColor(ImGuiCol_Text, color);
+                            }
+                            ImGui::Text("%02X", value);
+                            if (color != 0) {
+                                ImGui::PopStyleColor();
+                            }
+                        }
+                    }
                 }
             }
+            ImGui::EndChild();
 
             ImGui::End();
         }
@@ -260,28 +387,16 @@ inline void GUI::createWidgets(float &clockSpeed) {
     {
         bool displayOpen = true;
         ImGuiWindowFlags flags = ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoTitleBar;
+        ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
         if (ImGui::Begin("Display", &displayOpen, flags)) {
             const int SCALE = DISPLAY_WIDTH / 64;
 
-            auto pos = ImGui::GetWindowPos();
-            auto *drawList = ImGui::GetWindowDrawList();
-            for (int x = 0; x < 64; x++) {
-                for (int y = 0; y < 32; y++) {
-                    if (chip8->getDisplay(64 * y + x)) {
-                        drawList->AddRectFilled(ImVec2(pos[0] + x * SCALE, pos[1] + y * SCALE), 
-                                                ImVec2(pos[0] + (x + 1) * SCALE, pos[1] + (y + 1) * SCALE), 
-                                                0xFFFFFFFF);
-                    }
-                    else {
-                        drawList->AddRectFilled(ImVec2(pos[0] + x * SCALE, pos[1] + y * SCALE), 
-                                                ImVec2(pos[0] + (x + 1) * SCALE, pos[1] + (y + 1) * SCALE), 
-                                                0x000000FF);
-                    }
-                }
-            }
+            updateDisplayTexture(frame.state.display);
+            ImGui::Image((ImTextureID) displayTexture, ImVec2(SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE));
 
             ImGui::End();
         }
+        ImGui::PopStyleVar();
     }
 
     // GENERAL
@@ -295,27 +410,105 @@ inline void GUI::createWidgets(float &clockSpeed) {
             ImGui::Text("Clock");
             ImGui::PopStyleColor();
             // Pause button
-            if (ImGui::Button(chip8->isPaused() ? "Resume" : "Pause")) {
-                chip8->togglePaused();
+            if (ImGui::Button(frame.paused ? "Resume" : "Pause")) {
+                emulator->togglePaused();
             }
+            // Controls that change the machine in ways a movie can't record are greyed out
+            // while recording
             // Forward One Cycle Button
+            ImGui::BeginDisabled(frame.recording);
             if (ImGui::Button("Tick")) {
-                forwardOneCycle();
+                emulator->forwardOneCycle();
+            }
+            ImGui::EndDisabled();
+            // Save state slot
+            ImGui::SameLine();
+            if (ImGui::Button("Save")) {
+                emulator->saveState();
+            }
+            ImGui::SameLine();
+            ImGui::BeginDisabled(frame.recording);
+            if (ImGui::Button("Load") && frame.hasSavedState) {
+                emulator->loadState();
+            }
+            ImGui::EndDisabled();
+            // Engine
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("Engine:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            int engine = (int) frame.engine;
+            if (ImGui::Combo("##engine", &engine, "Interpreter\0Threaded\0Recompiler\0")) {
+                emulator->setEngine((Engine) engine);
+            }
+            // Variant
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("Variant:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            int variant = (int) frame.variant;
+            ImGui::BeginDisabled(frame.recording);
+            if (ImGui::Combo("##variant", &variant, "Modern\0CHIP-8\0CHIP-48\0SUPER-CHIP\0")) {
+                emulator->setVariant((Variant) variant);
             }
+            ImGui::EndDisabled();
             // Clock speed
             ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
             ImGui::Text("Clock Speed:");
             ImGui::PopStyleColor();
             ImGui::SameLine();
+            ImGui::BeginDisabled(frame.recording);
             ImGui::SliderFloat("float", &clockSpeed, 1.0, 1000.0);
+            ImGui::EndDisabled();
             ImGui::SameLine();
             ImGui::Text("Hz");
+            // Speed relative to real time; turbo runs as fast as the host allows
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("Speed:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            bool speedChanged = ImGui::SliderFloat("##speed", &speedMultiplier, 0.25, 16.0, "x%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SameLine();
+            speedChanged |= ImGui::Checkbox("Turbo", &turbo);
+            if (speedChanged) {
+                emulator->setSpeed(speedMultiplier, turbo);
+            }
+            // Rewind; dragging pauses on the chosen frame, and resuming discards the frames after it
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("Rewind:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            int rewindFrame = frame.rewindPosition;
+            ImGui::BeginDisabled(frame.recording);
+            if (ImGui::SliderInt("##rewind", &rewindFrame, 0, frame.rewindFrameCount - 1)) {
+                emulator->seekRewind(rewindFrame);
+            }
+            ImGui::EndDisabled();
+            ImGui::SameLine();
+            ImGui::Text("%.1fs, %.1f KB", frame.rewindFrameCount / 60.0, frame.rewindBytesUsed / 1024.0);
             // FPS
             ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
             ImGui::Text("FPS:");
             ImGui::PopStyleColor();
             ImGui::SameLine();
             ImGui::Text("%.2f", io->Framerate);
+            ImGui::SameLine();
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("CPU:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            ImGui::Text("%.1f%%", cpuUsage);
+            ImGui::SameLine();
+            ImGui::PushStyleColor(ImGuiCol_Text, TEXT_LABEL_COLOR);
+            ImGui::Text("MIPS:");
+            ImGui::PopStyleColor();
+            ImGui::SameLine();
+            if (frame.paused) {
+                ImGui::Text("-");
+            }
+            else {
+                ImGui::Text("%.3f (x%.1f)", frame.instructionsPerSecond / 1e6, frame.speed);
+            }
 
             ImGui::End();
         }
@@ -342,22 +535,22 @@ inline void GUI::createWidgets(float &clockSpeed) {
 
             for (int i = 0; i < 16; i++) {
                 // Push color if key pressed
-                if (chip8->getKey(hexToInt(chip8->chip8Keys[i]))) {
+                if (frame.state.keyMask & (1 << hexToInt(Chip8::chip8Keys[i]))) {
                     ImGui::PushStyleColor(ImGuiCol_Text, GREEN_COLOR);  
                 }
                 // If character is not last char in line
                 if (i % 4 != 3) {
-                    ImGui::Text("%c ", chip8->chip8Keys[i]);
+                    ImGui::Text("%c ", Chip8::chip8Keys[i]);
                     ImGui::SameLine();
                 }
                 // If character is last char in line
                 else {
-                    ImGui::Text("%c", chip8->chip8Keys[i]);
+                    ImGui::Text("%c", Chip8::chip8Keys[i]);
                     ImGui::Text("");
                     ImGui::SetCursorPosX(((DISPLAY_WIDTH - GENERAL_WIDTH) - textWidth) * 0.5f);
                 }
                 // Pop color if key was pressed
-                if (chip8->getKey(hexToInt(chip8->chip8Keys[i]))) {
+                if (frame.state.keyMask & (1 << hexToInt(Chip8::chip8Keys[i]))) {
                     ImGui::PopStyleColor();  
                 }
             }
@@ -370,6 +563,23 @@ int GUI::getWindowID() {
     return SDL_GetWindowID(window);
 }
 
-void GUI::forwardOneCycle() {
-    chip8->emulateCycle();
+void GUI::processKeyEvent(const SDL_Event &e) {
+    if ((e.type != SDL_KEYDOWN && e.type != SDL_KEYUP) || e.key.repeat) {
+        return;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (e.key.keysym.scancode == keybinds[i]) {
+            // SDL timestamps are whole milliseconds on its own clock; take the event's age
+            // off the current time
+            auto time = std::chrono::steady_clock::now() -
+                        std::chrono::milliseconds(SDL_GetTicks() - e.key.timestamp);
+            emulator->pushKeyEvent(i, e.type == SDL_KEYDOWN, time);
+            return;
+        }
+    }
+}
+
+bool GUI::isRewindHeld() {
+    const unsigned char *keyState = SDL_GetKeyboardState(NULL);
+    return keyState != nullptr && keyState[rewindKey];
 }
\ No newline at end of file
@@ -6,39 +6,99 @@ GUI for Chip 8 system
 #define GUI_H_INCLUDED
 
 #include "chip8.h"
+#include "emulator.h"
 #include "imgui.h"
+#include <SDL.h>
+#include <chrono>
+#include <ctime>
+
+#define GUI_IDLE_FRAME_INTERVAL 0.25 // Seconds between redraws while nothing changes
+#define GUI_ACTIVE_TIME 0.5 // Seconds to keep drawing at the display rate after an event
+#define CPU_USAGE_INTERVAL 0.5 // Seconds between updates of the CPU usage readout
 
 class GUI {
 private:
-    Chip8 *chip8;
+    Emulator *emulator;
     SDL_Window *window;
     SDL_Renderer *renderer;
     ImGuiIO *io;
+    // 64 x 32 ARGB texture holding the CHIP-8 screen; re-uploaded only when the framebuffer
+    // differs from uploadedDisplay
+    SDL_Texture *displayTexture;
+    uint64_t uploadedDisplay[SCREEN_HEIGHT];
+    bool displayUploaded = false;
+    // ARGB pixels for each value of a framebuffer byte, most significant bit first
+    uint32_t pixelLookup[256][8];
+    // Stores keybinds on user's system: index i corresponds to the keybind for CHIP-8 key with value i
+    SDL_Scancode keybinds[16] = {
+        SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, 
+        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+        SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+        SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
+    };
+    // Key held to step backwards through the rewind history
+    SDL_Scancode rewindKey = SDL_SCANCODE_BACKSPACE;
+    // When the next frame is due: one display refresh after the last, or GUI_IDLE_FRAME_INTERVAL
+    // while the emulator is paused and no events arrived for GUI_ACTIVE_TIME
+    std::chrono::steady_clock::time_point nextFrameTime;
+    std::chrono::steady_clock::time_point lastActivityTime;
+    std::chrono::steady_clock::duration refreshPeriod;
+    bool emulatorRunning = false;
+    // Share of one core used by the whole process, from the CPU time between samples
+    std::clock_t lastCpuTime;
+    std::chrono::steady_clock::time_point lastCpuSampleTime;
+    float cpuUsage = 0;
+    // Emulation speed set in the General window; see Emulator::setSpeed()
+    float speedMultiplier = 1;
+    bool turbo = false;
+    // Memory window: what it scrolls to follow (0 = nothing, 1 = PC, 2 = I), the row it last
+    // scrolled to, and the value of each byte when it was last shown, to highlight changes;
+    // shownMemory is seeded from the first frame so nothing is highlighted until it changes
+    int memoryFollow = 1;
+    int followedRow = -1;
+    unsigned char shownMemory[4096] = {};
+    bool shownMemorySeeded = false;
+    /*
+    Copies the framebuffer into displayTexture if it changed since the last upload
+    */
+    void updateDisplayTexture(const uint64_t *display);
 
     /*
-    Creates widgets on GUI
+    Creates widgets on GUI showing a frame published by the emulator
     */
-    void createWidgets(float &clockSpeed);
+    void createWidgets(const EmulatorFrame &frame, float &clockSpeed);
 
 public:
-    GUI(Chip8 *chip8);
+    GUI(Emulator *emulator);
     ~GUI();
 
     /*
-    Updates GUI using state of CHIP 8
+    Updates GUI using the latest state published by the emulator; never waits for the
+    emulation thread
     */
     void renderGUI(float &clockSpeed);
 
+    /*
+    Sleeps until an event arrives or the next frame is due, whichever comes first
+    Returns true with the event in e, or false once the frame is due and no events are pending
+    */
+    bool waitEvent(SDL_Event &e);
+
     /*
     Get numerical id of SDL window
     */
     int getWindowID();
 
     /*
-    Forwards Chip 8 by one emulation cycle
+    Forwards presses and releases of keys bound to the CHIP-8 keypad to the emulator,
+    stamped with the time SDL received them; other events are ignored
+    */
+    void processKeyEvent(const SDL_Event &e);
+
+    /*
+    Check if the rewind key is held
     */
-    void forwardOneCycle(); 
-    
+    bool isRewindHeld();
 };
 
 #endif
\ No newline at end of file
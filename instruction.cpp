@@ -0,0 +1,67 @@
+#include "instruction.h"
+
+Instruction decodeInstruction(unsigned short opcode) {
+    Instruction instruction;
+    instruction.x = (opcode & 0x0F00) >> 8;
+    instruction.y = (opcode & 0x00F0) >> 4;
+    instruction.n = opcode & 0x000F;
+    instruction.kk = opcode & 0x00FF;
+    instruction.nnn = opcode & 0x0FFF;
+
+    Op op = Op::Nop;
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            switch(opcode & 0x000F) {
+                case 0x0000: op = Op::ClearScreen; break;   // 0x00E0: Clears display
+                case 0x000E: op = Op::Return; break;        // 0x00EE: Returns from subroutine
+            }
+            break;
+        case 0x1000: op = Op::Jump; break;                  // 0x1nnn: Set program counter to nnn
+        case 0x2000: op = Op::Call; break;                  // 0x2nnn: Calls subroutine at nnn
+        case 0x3000: op = Op::SkipEqualImm; break;          // 0x3xkk: Skip next instruction if register Vx == kk
+        case 0x4000: op = Op::SkipNotEqualImm; break;       // 0x4xkk: Skip next instruction if register Vx != kk
+        case 0x5000: op = Op::SkipEqualReg; break;          // 0x5xy0: Skip next instruction if Vx == Vy
+        case 0x6000: op = Op::LoadImm; break;               // 0x6xkk: Set Vx = kk
+        case 0x7000: op = Op::AddImm; break;                // 0x7xkk: Increment Vx by kk
+        case 0x8000:
+            switch(opcode & 0x000F) {
+                case 0x0: op = Op::Move; break;             // 0x8xy0: Set Vx = Vy
+                case 0x1: op = Op::Or; break;               // 0x8xy1: Set Vx = Vx OR Vy
+                case 0x2: op = Op::And; break;              // 0x8xy2: Set Vx = Vx AND Vy
+                case 0x3: op = Op::Xor; break;              // 0x8xy3: Set Vx = Vx XOR Vy
+                case 0x4: op = Op::AddReg; break;           // 0x8xy4: Set Vx = Vx + Vy, and VF = carry
+                case 0x5: op = Op::SubReg; break;           // 0x8xy5: Set Vx = Vx - Vy, and VF = NOT borrow
+                case 0x6: op = Op::ShiftRight; break;       // 0x8xy6: Set VF = LSb of Vx; Set Vx = Vx >> 1
+                case 0x7: op = Op::SubReverse; break;       // 0x8xy7: Set Vx = Vy - Vx, and VF = NOT borrow
+                case 0xE: op = Op::ShiftLeft; break;        // 0x8xyE: Set VF = MSb of Vx; Set Vx = Vx << 1
+            }
+            break;
+        case 0x9000: op = Op::SkipNotEqualReg; break;       // 0x9xy0: Skip next instruction if Vx != Vy
+        case 0xA000: op = Op::LoadIndex; break;             // 0xAnnn: Set index register = nnn
+        case 0xB000: op = Op::JumpOffset; break;            // 0xBnnn: Jump to location nnn + V0
+        case 0xC000: op = Op::Random; break;                // 0xCxkk: Set Vx = random byte AND kk
+        case 0xD000: op = Op::Draw; break;                  // 0xDxyn: Draw n-byte sprite at (Vx, Vy), set VF = collision
+        case 0xE000:
+            switch (opcode & 0x000F) {
+                case 0xE: op = Op::SkipKeyPressed; break;   // 0xEx9E: Skip next instruction if key Vx is pressed
+                case 0x1: op = Op::SkipKeyNotPressed; break;// 0xExA1: Skip next instruction if key Vx is not pressed
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: op = Op::LoadDelay; break;       // 0xFx07: Set Vx to delay timer value
+                case 0x0A: op = Op::WaitKey; break;         // 0xFx0A: Wait for a key press, store the value of the key in Vx
+                case 0x15: op = Op::SetDelay; break;        // 0xFx15: Set delay timer = Vx
+                case 0x18: op = Op::SetSound; break;        // 0xFx18: Set sound timer = Vx
+                case 0x1E: op = Op::AddIndex; break;        // 0xFx1E: Set index register += Vx
+                case 0x29: op = Op::LoadFont; break;        // 0xFx29: Set index register = location of sprite for digit Vx
+                case 0x33: op = Op::StoreBCD; break;        // 0xFx33: Store BCD of Vx at index, index+1 and index+2
+                case 0x55: op = Op::StoreRegisters; break;  // 0xFx55: Copy V0 to Vx to memory, starting at index
+                case 0x65: op = Op::LoadRegisters; break;   // 0xFx65: Copy memory into V0 to Vx, starting at index
+            }
+            break;
+    }
+    instruction.op = op;
+
+    return instruction;
+}
@@ -0,0 +1,66 @@
+/*
+Decoded form of CHIP-8 instructions, shared by the interpreter and its decode cache
+*/
+
+#ifndef INSTRUCTION_H_INCLUDED
+#define INSTRUCTION_H_INCLUDED
+
+// Operation performed by an instruction; indexes the interpreter's handler table
+enum class Op : unsigned char {
+    Undecoded,          // Decode cache entry that has not been decoded yet (or was invalidated)
+    Nop,                // Unknown opcode; executes as no-op
+    ClearScreen,        // 0x00E0
+    Return,             // 0x00EE
+    Jump,               // 0x1nnn
+    Call,               // 0x2nnn
+    SkipEqualImm,       // 0x3xkk
+    SkipNotEqualImm,    // 0x4xkk
+    SkipEqualReg,       // 0x5xy0
+    LoadImm,            // 0x6xkk
+    AddImm,             // 0x7xkk
+    Move,               // 0x8xy0
+    Or,                 // 0x8xy1
+    And,                // 0x8xy2
+    Xor,                // 0x8xy3
+    AddReg,             // 0x8xy4
+    SubReg,             // 0x8xy5
+    ShiftRight,         // 0x8xy6
+    SubReverse,         // 0x8xy7
+    ShiftLeft,          // 0x8xyE
+    SkipNotEqualReg,    // 0x9xy0
+    LoadIndex,          // 0xAnnn
+    JumpOffset,         // 0xBnnn
+    Random,             // 0xCxkk
+    Draw,               // 0xDxyn
+    SkipKeyPressed,     // 0xEx9E
+    SkipKeyNotPressed,  // 0xExA1
+    LoadDelay,          // 0xFx07
+    WaitKey,            // 0xFx0A
+    SetDelay,           // 0xFx15
+    SetSound,           // 0xFx18
+    AddIndex,           // 0xFx1E
+    LoadFont,           // 0xFx29
+    StoreBCD,           // 0xFx33
+    StoreRegisters,     // 0xFx55
+    LoadRegisters,      // 0xFx65
+    Count
+};
+
+// Instruction with its operands already extracted from the opcode
+struct Instruction {
+    Op op = Op::Undecoded;
+    unsigned char x = 0;    // Register index in bits 8-11
+    unsigned char y = 0;    // Register index in bits 4-7
+    unsigned char n = 0;    // 4-bit immediate in bits 0-3
+    unsigned char kk = 0;   // 8-bit immediate in bits 0-7
+    unsigned short nnn = 0; // 12-bit address in bits 0-11
+};
+
+/*
+Decodes a 16-bit opcode into an operation and its operands
+Args:
+    - opcode: The big-endian opcode as fetched from memory
+*/
+Instruction decodeInstruction(unsigned short opcode);
+
+#endif
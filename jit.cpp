@@ -0,0 +1,353 @@
+#include <cstddef>
+#include <cstring>
+#include "jit.h"
+#include "chip8.h"
+
+#if JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+// x86-64 register numbers used in ModRM fields
+#define RAX 0
+#define RCX 1
+#define RDX 2
+
+// Appends machine code to the code buffer. Generated blocks are leaf functions following
+// the System V calling convention: rdi holds the Chip8State pointer for the whole block, and
+// CHIP-8 state is addressed as [rdi + disp32], so only caller-saved registers are touched.
+class Emitter {
+private:
+    unsigned char *code;
+    int size = 0;
+    int capacity;
+
+public:
+    Emitter(unsigned char *code, int capacity) : code(code), capacity(capacity) {}
+
+    int getSize() { return size; }
+    bool isFull() { return size > capacity; }
+
+    void byte(unsigned char b) {
+        if (size < capacity) {
+            code[size] = b;
+        }
+        size++;
+    }
+    void word(unsigned short w) {
+        byte(w & 0xFF);
+        byte(w >> 8);
+    }
+    void dword(unsigned int d) {
+        word(d & 0xFFFF);
+        word(d >> 16);
+    }
+    // ModRM for [rdi + disp32] with the given reg field
+    void state(int reg, int disp) {
+        byte(0x80 | (reg << 3) | 7);
+        dword(disp);
+    }
+
+    // movzx r32, byte [rdi + disp]
+    void loadByte(int reg, int disp) { byte(0x0F); byte(0xB6); state(reg, disp); }
+    // movzx r32, word [rdi + disp]
+    void loadWord(int reg, int disp) { byte(0x0F); byte(0xB7); state(reg, disp); }
+    // mov byte [rdi + disp], r8
+    void storeByte(int disp, int reg) { byte(0x88); state(reg, disp); }
+    // mov word [rdi + disp], r16
+    void storeWord(int disp, int reg) { byte(0x66); byte(0x89); state(reg, disp); }
+    // mov byte [rdi + disp], imm8
+    void storeByteImm(int disp, unsigned char imm) { byte(0xC6); state(0, disp); byte(imm); }
+    // mov word [rdi + disp], imm16
+    void storeWordImm(int disp, unsigned short imm) { byte(0x66); byte(0xC7); state(0, disp); word(imm); }
+    // <op> byte [rdi + disp], imm8 where group is the /digit of opcode 0x80
+    void byteImmOp(int group, int disp, unsigned char imm) { byte(0x80); state(group, disp); byte(imm); }
+    // <op> byte [rdi + disp], r8 for the 8-bit ALU opcodes (0x00 add, 0x08 or, 0x20 and, 0x30 xor)
+    void byteRegOp(int opcode, int disp, int reg) { byte(opcode); state(reg, disp); }
+    // mov r32, imm32
+    void moveImm(int reg, unsigned int imm) { byte(0xB8 + reg); dword(imm); }
+    // <op> r32, r32 for opcodes taking the source in the reg field (0x01 add, 0x29 sub, 0x89 mov)
+    void regOp(int opcode, int dst, int src) { byte(opcode); byte(0xC0 | (src << 3) | dst); }
+    // and r32, imm8
+    void andImm(int reg, unsigned char imm) { byte(0x83); byte(0xE0 | reg); byte(imm); }
+    // shr r32, imm8
+    void shiftRightImm(int reg, unsigned char imm) { byte(0xC1); byte(0xE8 | reg); byte(imm); }
+    // setg r8
+    void setGreater(int reg) { byte(0x0F); byte(0x9F); byte(0xC0 | reg); }
+    // cmove/cmovne r32, r32
+    void conditionalMove(bool ifEqual, int dst, int src) { byte(0x0F); byte(ifEqual ? 0x44 : 0x45); byte(0xC0 | (dst << 3) | src); }
+    void ret() { byte(0xC3); }
+};
+
+Jit::Jit() {
+#if JIT_SUPPORTED
+    void *memory = mmap(nullptr, JIT_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+        codeBuffer = (unsigned char *) memory;
+        // Hosts that forbid making written memory executable get the interpreter instead
+        if (!setCodeWritable(false)) {
+            munmap(codeBuffer, JIT_CODE_BUFFER_SIZE);
+            codeBuffer = nullptr;
+        }
+    }
+#endif
+}
+
+Jit::~Jit() {
+#if JIT_SUPPORTED
+    if (codeBuffer != nullptr) {
+        munmap(codeBuffer, JIT_CODE_BUFFER_SIZE);
+    }
+#endif
+}
+
+bool Jit::isAvailable() {
+    return codeBuffer != nullptr;
+}
+
+bool Jit::setCodeWritable(bool writable) {
+#if JIT_SUPPORTED
+    if (writable != codeWritable) {
+        if (mprotect(codeBuffer, JIT_CODE_BUFFER_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) {
+            return false;
+        }
+        codeWritable = writable;
+    }
+#endif
+    return true;
+}
+
+void Jit::flush() {
+    for (int i = 0; i < 4096; i++) {
+        blocks[i] = Block();
+    }
+    memset(covered, 0, sizeof(covered));
+    codeSize = 0;
+}
+
+void Jit::invalidate(unsigned short address) {
+    if (covered[address & 0xFFF]) {
+        flush();
+    }
+}
+
+Jit::Block &Jit::compile(Chip8 &chip8, unsigned short address) {
+    if (!setCodeWritable(true)) {
+        // Leave the block to the interpreter
+        blocks[address].compiled = true;
+        return blocks[address];
+    }
+    Block &block = emitBlock(chip8, address);
+    if (!setCodeWritable(false)) {
+        // The new code can't be made executable; nothing compiled may run
+        flush();
+        blocks[address].compiled = true;
+        return blocks[address];
+    }
+    return block;
+}
+
+Jit::Block &Jit::emitBlock(Chip8 &chip8, unsigned short address) {
+    Block &block = blocks[address];
+    block.compiled = true;
+
+    const int V = offsetof(Chip8State, registers);
+    const int VF = V + 0xF;
+    const int I = offsetof(Chip8State, index);
+    const int PC = offsetof(Chip8State, programCounter);
+    const int SP = offsetof(Chip8State, stackPointer);
+    const int STACK = offsetof(Chip8State, stack);
+    const int DT = offsetof(Chip8State, delayTimer);
+    const int ST = offsetof(Chip8State, soundTimer);
+    // Quirks are resolved while compiling; changing variant flushes the blocks
+    const QuirkFlags quirks = getQuirkFlags(chip8.variant);
+
+    Emitter e(codeBuffer + codeSize, JIT_CODE_BUFFER_SIZE - codeSize);
+    unsigned short pc = address;
+    int length = 0;
+    bool terminated = false;
+
+    while (!terminated && length < JIT_MAX_BLOCK_LENGTH && pc + 1 < 4096) {
+        Instruction in = decodeInstruction(chip8.state.memory[pc] << 8 | chip8.state.memory[pc + 1]);
+        unsigned short next = pc + 2;
+
+        switch (in.op) {
+            case Op::Nop:
+                break;
+            case Op::LoadImm:
+                e.storeByteImm(V + in.x, in.kk);
+                break;
+            case Op::AddImm:
+                e.byteImmOp(0, V + in.x, in.kk);
+                break;
+            case Op::Move:
+                e.loadByte(RAX, V + in.y);
+                e.storeByte(V + in.x, RAX);
+                break;
+            case Op::Or:
+            case Op::And:
+            case Op::Xor:
+                e.loadByte(RAX, V + in.y);
+                e.byteRegOp(in.op == Op::Or ? 0x08 : in.op == Op::And ? 0x20 : 0x30, V + in.x, RAX);
+                if (quirks.logicResetsVF) {
+                    e.storeByteImm(VF, 0);
+                }
+                break;
+            case Op::AddReg:
+                e.loadByte(RAX, V + in.x);
+                e.loadByte(RCX, V + in.y);
+                e.regOp(0x01, RAX, RCX);
+                e.storeByte(V + in.x, RAX);
+                e.shiftRightImm(RAX, 8);
+                e.storeByte(VF, RAX);
+                break;
+            case Op::SubReg:
+            case Op::SubReverse:
+                // VF = 1 only if the signed difference is positive
+                e.loadByte(RAX, V + (in.op == Op::SubReg ? in.x : in.y));
+                e.loadByte(RCX, V + (in.op == Op::SubReg ? in.y : in.x));
+                e.regOp(0x29, RAX, RCX);
+                e.setGreater(RDX);
+                e.storeByte(V + in.x, RAX);
+                e.storeByte(VF, RDX);
+                break;
+            case Op::ShiftRight:
+            case Op::ShiftLeft:
+                // Vx is written before VF, as in the interpreter
+                e.loadByte(RAX, V + (quirks.shiftUsesVy ? in.y : in.x));
+                e.regOp(0x89, RCX, RAX); // mov ecx, eax
+                if (in.op == Op::ShiftRight) {
+                    e.shiftRightImm(RCX, 1);
+                    e.andImm(RAX, 0x01);
+                }
+                else {
+                    e.regOp(0x01, RCX, RCX); // add ecx, ecx
+                    e.shiftRightImm(RAX, 7);
+                }
+                e.storeByte(V + in.x, RCX);
+                e.storeByte(VF, RAX);
+                break;
+            case Op::LoadIndex:
+                e.storeWordImm(I, in.nnn);
+                break;
+            case Op::AddIndex:
+                e.loadByte(RAX, V + in.x);
+                e.byte(0x66); e.byteRegOp(0x01, I, RAX); // add word [I], ax
+                break;
+            case Op::LoadDelay:
+                e.loadWord(RAX, DT);
+                e.storeByte(V + in.x, RAX);
+                break;
+            case Op::SetDelay:
+            case Op::SetSound:
+                e.loadByte(RAX, V + in.x);
+                e.storeWord(in.op == Op::SetDelay ? DT : ST, RAX);
+                break;
+            case Op::Jump:
+                e.storeWordImm(PC, in.nnn);
+                terminated = true;
+                break;
+            case Op::JumpOffset:
+                e.loadByte(RAX, V + (quirks.jumpUsesVx ? in.x : 0));
+                e.byte(0x05); e.dword(in.nnn); // add eax, nnn
+                e.storeWord(PC, RAX);
+                terminated = true;
+                break;
+            case Op::Call:
+                // stack[SP & 0xF] = next; SP = (SP + 1) & 0xF
+                e.loadByte(RAX, SP);
+                e.andImm(RAX, 0x0F);
+                e.byte(0x66); e.byte(0xC7); e.byte(0x84); e.byte(0x47); e.dword(STACK); e.word(next); // mov word [rdi + rax*2 + STACK], next
+                e.byte(0xFF); e.byte(0xC0); // inc eax
+                e.andImm(RAX, 0x0F);
+                e.storeByte(SP, RAX);
+                e.storeWordImm(PC, in.nnn);
+                terminated = true;
+                break;
+            case Op::Return:
+                // SP = (SP - 1) & 0xF; PC = stack[SP]
+                e.loadByte(RAX, SP);
+                e.byte(0xFF); e.byte(0xC8); // dec eax
+                e.andImm(RAX, 0x0F);
+                e.storeByte(SP, RAX);
+                e.byte(0x0F); e.byte(0xB7); e.byte(0x8C); e.byte(0x47); e.dword(STACK); // movzx ecx, word [rdi + rax*2 + STACK]
+                e.storeWord(PC, RCX);
+                terminated = true;
+                break;
+            case Op::SkipEqualImm:
+            case Op::SkipNotEqualImm:
+            case Op::SkipEqualReg:
+            case Op::SkipNotEqualReg:
+                e.moveImm(RAX, next);
+                e.moveImm(RCX, next + 2);
+                if (in.op == Op::SkipEqualImm || in.op == Op::SkipNotEqualImm) {
+                    e.byteImmOp(7, V + in.x, in.kk); // cmp byte [Vx], kk
+                }
+                else {
+                    e.loadByte(RDX, V + in.x);
+                    e.byte(0x3A); e.state(RDX, V + in.y); // cmp dl, byte [Vy]
+                }
+                e.conditionalMove(in.op == Op::SkipEqualImm || in.op == Op::SkipEqualReg, RAX, RCX);
+                e.storeWord(PC, RAX);
+                terminated = true;
+                break;
+            default:
+                // Drawing, input, memory access, randomness and 0xFx0A stay in the interpreter;
+                // the block ends just before them
+                goto endOfBlock;
+        }
+
+        pc = next;
+        length++;
+    }
+endOfBlock:
+
+    if (length == 0) {
+        return block;
+    }
+    if (!terminated) {
+        e.storeWordImm(PC, pc);
+    }
+    e.ret();
+
+    if (e.isFull()) {
+        // Out of executable memory: start over and compile this block into the empty buffer
+        flush();
+        return emitBlock(chip8, address);
+    }
+
+    block.entry = (void (*)(Chip8State *)) (codeBuffer + codeSize);
+    block.length = length;
+    codeSize += e.getSize();
+    for (int i = address; i < pc && i < 4096; i++) {
+        covered[i] = 1;
+    }
+
+    return block;
+}
+
+void Jit::run(Chip8 &chip8, int cycles) {
+    int remaining = cycles;
+    while (remaining > 0 && !chip8.state.pausedForKeyPress) {
+        if (chip8.state.programCounter >= 4096) {
+            // Only reachable through 0xBnnn; let the interpreter handle the wrap-around
+            chip8.step();
+            remaining--;
+            continue;
+        }
+
+        Block *block = &blocks[chip8.state.programCounter];
+        if (!block->compiled) {
+            block = &compile(chip8, chip8.state.programCounter);
+        }
+
+        if (block->entry != nullptr && block->length <= remaining) {
+            block->entry(&chip8.state);
+            remaining -= block->length;
+        }
+        else {
+            chip8.step();
+            remaining--;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+Dynamic recompiler for Chip 8 system; translates basic blocks into x86-64 machine code
+*/
+
+#ifndef JIT_H_INCLUDED
+#define JIT_H_INCLUDED
+
+#define JIT_CODE_BUFFER_SIZE (256 * 1024) // Bytes of executable memory; flushed when full
+#define JIT_MAX_BLOCK_LENGTH 64 // Most instructions compiled into one block
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+class Chip8;
+struct Chip8State;
+
+class Jit {
+private:
+    // Native code for a run of CHIP-8 instructions; entry is null for addresses whose
+    // first instruction can't be compiled (those always go through the interpreter)
+    struct Block {
+        void (*entry)(Chip8State *state) = nullptr;
+        int length = 0; // Number of CHIP-8 instructions executed by the block
+        bool compiled = false;
+    };
+
+    Block blocks[4096];
+    // Set for each memory byte that some compiled block was compiled from; writing a
+    // covered byte flushes the block cache
+    unsigned char covered[4096] = {};
+    // The code buffer is never writable and executable at once: it is read-write while a
+    // block is emitted and read-execute otherwise
+    unsigned char *codeBuffer = nullptr;
+    int codeSize = 0;
+    bool codeWritable = true;
+
+    /*
+    Compiles the basic block starting at address, with the code buffer writable for the
+    duration
+    */
+    Block &compile(Chip8 &chip8, unsigned short address);
+
+    /*
+    Emits the basic block starting at address into the writable code buffer
+    */
+    Block &emitBlock(Chip8 &chip8, unsigned short address);
+
+    /*
+    Switches the code buffer between read-write and read-execute
+    Returns false if the host refused
+    */
+    bool setCodeWritable(bool writable);
+
+public:
+    Jit();
+    ~Jit();
+
+    /*
+    Check if native code can be generated on this host
+    */
+    bool isAvailable();
+
+    /*
+    Runs up to cycles instructions, executing compiled blocks where they fit in the
+    remaining budget and interpreting everything else
+    */
+    void run(Chip8 &chip8, int cycles);
+
+    /*
+    Called for every memory write; drops compiled code containing address
+    */
+    void invalidate(unsigned short address);
+
+    /*
+    Discards every compiled block
+    */
+    void flush();
+};
+
+#endif
@@ -1,59 +1,89 @@
 /* 
 Emulates Chip 8 system and runs the ROM located at the provided file path
 */
+#include <ctime>
 #include <iostream>
+#include <memory>
 #include "chip8.h"
+#include "emulator.h"
 #include "gui.h"
+#include "movie.h"
+#include "rewind.h"
+#include "scheduler.h"
 #include "imgui_impl_sdl2.h"
 
 
 
 int main(int argc, char **argv) {
     try{
-        if (argc != 2) {
+        // Usage: chip8 <rom> [variant] [--record <movie>]
+        std::string movieFileName;
+        if (argc >= 4 && std::string(argv[argc - 2]) == "--record") {
+            movieFileName = argv[argc - 1];
+            argc -= 2;
+        }
+        if (argc != 2 && argc != 3) {
             throw std::invalid_argument("Invalid number of arguments");
         }
+        Variant variant = Variant::Modern;
+        if (argc == 3 && !parseVariant(argv[2], variant)) {
+            throw std::invalid_argument("Unknown variant; expected modern, chip8, chip48 or schip");
+        }
 
         Chip8 chip8;
-        GUI gui(&chip8);
+        Rewind rewind;
 
         chip8.initializeInput();
-        chip8.loadGame(argv[1]);
+        chip8.loadGame(argv[1], variant);
 
-        const float timersCycleDuration = 1000 / 60; // 60 Hz timers
         float clockSpeed = 500; // Clock speed in Hertz
 
+        // While recording a movie, emulation advances in whole frames of a fixed number of
+        // cycles so that it can be replayed exactly; the clock is pinned to a whole number of
+        // cycles per frame so the timers still tick at 60 Hz
+        std::unique_ptr<Movie> movie;
+        if (!movieFileName.empty()) {
+            movie.reset(new Movie(chip8.getRomHash(), variant, (unsigned int) time(nullptr),
+                                  (int) (clockSpeed / TIMERS_FREQUENCY + 0.5f)));
+            movie->begin(chip8);
+            clockSpeed = movie->getCyclesPerFrame() * TIMERS_FREQUENCY;
+        }
+
+        // The machine runs on the emulator's thread from here on; this thread only handles
+        // events and draws the frames it publishes, so neither can hold up the other
+        Emulator emulator(&chip8, &rewind, movie.get(), clockSpeed);
+        GUI gui(&emulator);
+        emulator.start();
+
         SDL_Event e;
-        auto lastCycleTime = std::chrono::high_resolution_clock::now();
-        auto lastTimersTime = lastCycleTime;
+        bool quit = false;
         while (true){
-            float cycleDuration = (1  / clockSpeed) * 1e3; // Duration of a cycle
-            
-            // Check if user quits out of window
-            if (SDL_PollEvent(&e) == 1 && e.type == SDL_QUIT){
-                return EXIT_SUCCESS;
+            // Sleep until the next frame is due, handling every event that arrives in the
+            // meantime; key presses go to the emulator with their timestamps
+            while (gui.waitEvent(e)) {
+                // Check if user quits out of window
+                if (e.type == SDL_QUIT) {
+                    quit = true;
+                }
+                ImGui_ImplSDL2_ProcessEvent(&e);
+                if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_CLOSE && e.window.windowID == gui.getWindowID()) {
+                    quit = true;
+                }
+                gui.processKeyEvent(e);
             }
-            ImGui_ImplSDL2_ProcessEvent(&e);
-            if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_CLOSE && e.window.windowID == gui.getWindowID()) {
-                return EXIT_SUCCESS;
+            if (quit) {
+                break;
             }
-           
-           
-            auto currentTime = std::chrono::high_resolution_clock::now();
-		    float dtCycle = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
-		    float dtTimer = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastTimersTime).count();
-            // Run next emulation cycle
-            if (dtCycle > cycleDuration && !chip8.isPaused()) {
-                lastCycleTime = currentTime;
-                chip8.emulateCycle();
-            }
-            // Decrement timers
-            if (dtTimer > timersCycleDuration && !chip8.isPaused()) {
-                lastTimersTime = currentTime;
-                chip8.updateTimers();
-            }  
-            
-            gui.renderGUI(clockSpeed); // Pass clockSpeed by reference so that GUI can display it          
+
+            emulator.setRewindHeld(gui.isRewindHeld());
+
+            gui.renderGUI(clockSpeed); // Pass clockSpeed by reference so that GUI can display it
+            emulator.setClockSpeed(clockSpeed);
+        }
+        emulator.stop();
+
+        if (movie) {
+            movie->save(movieFileName);
         }
     } catch(std::exception& e) {
         std::cout << e.what() << std::endl;
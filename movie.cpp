@@ -0,0 +1,112 @@
+#include <cstring>
+#include <fstream>
+#include "movie.h"
+
+// Header of a movie file; followed by frameCount 16-bit key masks, all in host byte order
+struct MovieFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t romHash;
+    uint32_t seed;
+    uint32_t variant;
+    uint32_t cyclesPerFrame;
+    uint32_t frameCount;
+};
+
+Movie::Movie(uint64_t romHash, Variant variant, unsigned int seed, int cyclesPerFrame)
+    : romHash(romHash), variant(variant), seed(seed), cyclesPerFrame(cyclesPerFrame) {}
+
+Movie::Movie(std::string fileName) {
+    std::ifstream fin(fileName, std::ios::binary);
+    if (!fin.is_open()) {
+        throw Chip8::InitializationError("Unable to open movie file");
+    }
+
+    MovieFileHeader header;
+    if (!fin.read((char *) &header, sizeof(header)) || memcmp(header.magic, MOVIE_FILE_MAGIC, 4) != 0) {
+        throw Chip8::InitializationError("Not a movie file");
+    }
+    if (header.version != MOVIE_FILE_VERSION) {
+        throw Chip8::InitializationError("Unsupported movie version");
+    }
+    if (header.variant >= VARIANT_COUNT) {
+        throw Chip8::InitializationError("Unknown variant in movie file");
+    }
+    if (header.cyclesPerFrame < 1 || header.cyclesPerFrame > MOVIE_MAX_CYCLES_PER_FRAME) {
+        throw Chip8::InitializationError("Movie has " + std::to_string(header.cyclesPerFrame) +
+                                         " cycles per frame; expected 1 to " + std::to_string(MOVIE_MAX_CYCLES_PER_FRAME));
+    }
+
+    romHash = header.romHash;
+    variant = (Variant) header.variant;
+    seed = header.seed;
+    cyclesPerFrame = header.cyclesPerFrame;
+    keyMasks.resize(header.frameCount);
+    if (!fin.read((char *) keyMasks.data(), keyMasks.size() * sizeof(unsigned short))) {
+        throw Chip8::InitializationError("Truncated movie file");
+    }
+}
+
+void Movie::save(std::string fileName) {
+    std::ofstream fout(fileName, std::ios::binary);
+    if (!fout.is_open()) {
+        throw Chip8::InitializationError("Unable to open movie file");
+    }
+
+    MovieFileHeader header;
+    memcpy(header.magic, MOVIE_FILE_MAGIC, 4);
+    header.version = MOVIE_FILE_VERSION;
+    header.romHash = romHash;
+    header.seed = seed;
+    header.variant = (uint32_t) variant;
+    header.cyclesPerFrame = cyclesPerFrame;
+    header.frameCount = keyMasks.size();
+    fout.write((const char *) &header, sizeof(header));
+    fout.write((const char *) keyMasks.data(), keyMasks.size() * sizeof(unsigned short));
+    if (!fout) {
+        throw Chip8::InitializationError("Unable to write movie file");
+    }
+}
+
+void Movie::begin(Chip8 &chip8) {
+    chip8.setVariant(variant);
+    chip8.seedRandom(seed);
+    chip8.setClockSpeed(cyclesPerFrame * TIMERS_FREQUENCY);
+    playbackFrame = 0;
+}
+
+void Movie::recordFrame(Chip8 &chip8, unsigned short keyMask) {
+    keyMasks.push_back(keyMask);
+    chip8.setKeyMask(keyMask);
+    chip8.runTimed(cyclesPerFrame);
+}
+
+bool Movie::playFrame(Chip8 &chip8) {
+    if (playbackFrame >= (int) keyMasks.size()) {
+        return false;
+    }
+    chip8.setKeyMask(keyMasks[playbackFrame++]);
+    chip8.runTimed(cyclesPerFrame);
+    return true;
+}
+
+uint64_t Movie::getRomHash() {
+    return romHash;
+}
+
+Variant Movie::getVariant() {
+    return variant;
+}
+
+int Movie::getCyclesPerFrame() {
+    return cyclesPerFrame;
+}
+
+int Movie::getFrameCount() {
+    return keyMasks.size();
+}
+
+uint64_t Movie::hashRom(std::string fileName) {
+    std::vector<unsigned char> rom = Chip8::readRom(fileName);
+    return Chip8::hashRom(rom.data(), rom.size());
+}
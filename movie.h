@@ -0,0 +1,79 @@
+/*
+Input movies for Chip 8 system; a recording of the key mask of every emulated frame that
+replays a session exactly
+*/
+
+#ifndef MOVIE_H_INCLUDED
+#define MOVIE_H_INCLUDED
+
+#define MOVIE_FILE_MAGIC "C8MV"
+#define MOVIE_FILE_VERSION 1
+#define MOVIE_MAX_CYCLES_PER_FRAME 1000000 // Largest cyclesPerFrame accepted from a movie file, i.e. a 60 MHz clock
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+class Movie {
+private:
+    // Everything that decides how a session plays out besides the key presses
+    uint64_t romHash;
+    Variant variant;
+    unsigned int seed;
+    int cyclesPerFrame;
+    // Key mask held during each frame
+    std::vector<unsigned short> keyMasks;
+    int playbackFrame = 0;
+
+public:
+    /*
+    Starts an empty recording
+    Args:
+        - romHash: Hash of the ROM being played, as returned by hashRom()
+        - variant: Variant the ROM runs as
+        - seed: Seed for the random number generator
+        - cyclesPerFrame: Instructions executed between two 60 Hz timer ticks
+    */
+    Movie(uint64_t romHash, Variant variant, unsigned int seed, int cyclesPerFrame);
+
+    /*
+    Reads a recording from a movie file
+    */
+    Movie(std::string fileName);
+
+    /*
+    Writes the recording to a movie file
+    */
+    void save(std::string fileName);
+
+    /*
+    Prepares a CHIP-8 with the game already loaded to record or replay this movie: selects
+    the variant, seeds the random number generator and sets the clock speed to
+    cyclesPerFrame * 60, so runTimed() ticks the timers exactly once per frame
+    */
+    void begin(Chip8 &chip8);
+
+    /*
+    Runs one frame with the given keys held and appends it to the recording
+    */
+    void recordFrame(Chip8 &chip8, unsigned short keyMask);
+
+    /*
+    Runs the next recorded frame
+    Returns false once every frame has been replayed
+    */
+    bool playFrame(Chip8 &chip8);
+
+    uint64_t getRomHash();
+    Variant getVariant();
+    int getCyclesPerFrame();
+    int getFrameCount();
+
+    /*
+    Returns the 64-bit FNV-1a hash of a ROM file
+    */
+    static uint64_t hashRom(std::string fileName);
+};
+
+#endif
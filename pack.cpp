@@ -0,0 +1,60 @@
+/*
+Packs a directory of ROMs into a single ROM pack for the farm and other batch runs, or lists
+the contents of a pack
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include "chip8.h"
+#include "rom_pack.h"
+
+int main(int argc, char **argv) {
+    try {
+        if (argc != 3) {
+            throw std::invalid_argument("Usage: chip8-pack <rom-directory> <pack-file>\n"
+                                        "       chip8-pack --list <pack-file>");
+        }
+
+        if (std::string(argv[1]) == "--list") {
+            RomPack pack(argv[2]);
+            for (int i = 0; i < pack.getRomCount(); i++) {
+                PackedRom rom = pack.getRom(i);
+                printf("%016llx %5zu %.*s\n", (unsigned long long) rom.hash, rom.size,
+                       (int) rom.name.size(), rom.name.data());
+            }
+            return EXIT_SUCCESS;
+        }
+
+        // Every regular file under the directory is a ROM, named by its path relative to it
+        std::filesystem::path directory = argv[1];
+        std::vector<std::filesystem::path> files;
+        for (const auto &file : std::filesystem::recursive_directory_iterator(directory)) {
+            if (file.is_regular_file()) {
+                files.push_back(file.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+
+        std::vector<std::string> names;
+        std::vector<std::vector<unsigned char>> roms;
+        for (const std::filesystem::path &file : files) {
+            std::string name = file.lexically_relative(directory).generic_string();
+            try {
+                roms.push_back(Chip8::readRom(file.string()));
+                names.push_back(name);
+            } catch(std::exception& e) {
+                std::cout << "Skipping " << name << ": " << e.what() << std::endl;
+            }
+        }
+
+        RomPack::write(argv[2], names, roms);
+        std::cout << "Packed " << roms.size() << " ROMs into " << argv[2] << std::endl;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#include "quirks.h"
+
+template <typename Quirks>
+static QuirkFlags flagsOf() {
+    return { Quirks::shiftUsesVy, Quirks::loadStoreIndexIncrement, Quirks::jumpUsesVx,
+             Quirks::clipSprites, Quirks::logicResetsVF, Quirks::programEnd };
+}
+
+QuirkFlags getQuirkFlags(Variant variant) {
+    switch (variant) {
+        case Variant::Original: return flagsOf<OriginalQuirks>();
+        case Variant::Chip48: return flagsOf<Chip48Quirks>();
+        case Variant::SuperChip: return flagsOf<SuperChipQuirks>();
+        default: return flagsOf<ModernQuirks>();
+    }
+}
+
+static const char *const variantNames[VARIANT_COUNT] = { "modern", "chip8", "chip48", "schip" };
+
+const char *getVariantName(Variant variant) {
+    return variantNames[(int) variant];
+}
+
+bool parseVariant(const std::string &name, Variant &variant) {
+    for (int i = 0; i < VARIANT_COUNT; i++) {
+        if (name == variantNames[i]) {
+            variant = (Variant) i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,95 @@
+/*
+Behaviours that differ between CHIP-8 implementations. Each variant is a policy type of
+compile-time constants; the core instantiates its handlers once per policy, so selecting a
+variant costs nothing per instruction.
+*/
+
+#ifndef QUIRKS_H_INCLUDED
+#define QUIRKS_H_INCLUDED
+
+#include <string>
+
+#define VARIANT_COUNT 4 // Number of values of Variant; files store variants as 0 to VARIANT_COUNT - 1
+
+// CHIP-8 implementation whose quirks the core emulates
+enum class Variant {
+    Modern,     // Behaviour of this interpreter before quirks were configurable; the default
+    Original,   // COSMAC VIP CHIP-8
+    Chip48,     // CHIP-48 on the HP-48
+    SuperChip,  // SUPER-CHIP 1.1
+};
+
+// How 0xFx55 and 0xFx65 leave the index register
+enum class IndexIncrement {
+    None,       // I is unchanged
+    ByX,        // I += x
+    ByXPlusOne, // I += x + 1, i.e. I points past the last byte accessed
+};
+
+struct ModernQuirks {
+    static constexpr bool shiftUsesVy = false;      // 0x8xy6/0x8xyE shift Vy into Vx instead of shifting Vx
+    static constexpr IndexIncrement loadStoreIndexIncrement = IndexIncrement::None;
+    static constexpr bool jumpUsesVx = false;       // 0xBxnn jumps to xnn + Vx instead of nnn + V0
+    static constexpr bool clipSprites = false;      // 0xDxyn clips sprites at the screen edges instead of wrapping
+    static constexpr bool logicResetsVF = false;    // 0x8xy1/0x8xy2/0x8xy3 set VF = 0
+    static constexpr unsigned short programEnd = 0x1000; // First address past the space a ROM can load into
+};
+
+struct OriginalQuirks {
+    static constexpr bool shiftUsesVy = true;
+    static constexpr IndexIncrement loadStoreIndexIncrement = IndexIncrement::ByXPlusOne;
+    static constexpr bool jumpUsesVx = false;
+    static constexpr bool clipSprites = true;
+    static constexpr bool logicResetsVF = true;
+    static constexpr unsigned short programEnd = 0xEA0; // The VIP keeps its stack, variables and display above
+};
+
+struct Chip48Quirks {
+    static constexpr bool shiftUsesVy = false;
+    static constexpr IndexIncrement loadStoreIndexIncrement = IndexIncrement::ByX;
+    static constexpr bool jumpUsesVx = true;
+    static constexpr bool clipSprites = true;
+    static constexpr bool logicResetsVF = false;
+    static constexpr unsigned short programEnd = 0x1000;
+};
+
+struct SuperChipQuirks {
+    static constexpr bool shiftUsesVy = false;
+    static constexpr IndexIncrement loadStoreIndexIncrement = IndexIncrement::None;
+    static constexpr bool jumpUsesVx = true;
+    static constexpr bool clipSprites = true;
+    static constexpr bool logicResetsVF = false;
+    static constexpr unsigned short programEnd = 0x1000;
+};
+
+// Quirks of a variant as run-time values, for code generators that choose behaviour while
+// translating rather than per instruction
+struct QuirkFlags {
+    bool shiftUsesVy;
+    IndexIncrement loadStoreIndexIncrement;
+    bool jumpUsesVx;
+    bool clipSprites;
+    bool logicResetsVF;
+    unsigned short programEnd;
+};
+
+/*
+Returns the quirks of a variant as run-time values
+*/
+QuirkFlags getQuirkFlags(Variant variant);
+
+/*
+Returns the command-line name of a variant ("modern", "chip8", "chip48" or "schip")
+*/
+const char *getVariantName(Variant variant);
+
+/*
+Looks up a variant by its command-line name
+Args:
+    - name: Name as returned by getVariantName()
+    - variant: Set to the matching variant
+Returns false if no variant has that name
+*/
+bool parseVariant(const std::string &name, Variant &variant);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+Headless movie player; replays a recorded session at full host speed and prints the final
+screen, so movies double as regression tests and benchmarks
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "chip8.h"
+#include "movie.h"
+
+int main(int argc, char **argv) {
+    try {
+        if (argc != 3 && argc != 4) {
+            throw std::invalid_argument("Usage: chip8-replay <rom> <movie> [interpreter|threaded|recompiler]");
+        }
+
+        Movie movie(argv[2]);
+
+        Chip8 chip8;
+        if (argc == 4) {
+            std::string engine = argv[3];
+            if (engine == "threaded") {
+                chip8.setEngine(Engine::Threaded);
+            }
+            else if (engine == "recompiler") {
+                chip8.setEngine(Engine::Recompiler);
+            }
+            else if (engine != "interpreter") {
+                throw std::invalid_argument("Unknown engine; expected interpreter, threaded or recompiler");
+            }
+        }
+        chip8.loadGame(argv[1], movie.getVariant());
+        if (chip8.getRomHash() != movie.getRomHash()) {
+            throw std::invalid_argument("Movie was recorded with a different ROM");
+        }
+        movie.begin(chip8);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        while (movie.playFrame(chip8)) {}
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        // FNV-1a over the framebuffer identifies the final screen
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                bool pixel = chip8.getDisplay(y * SCREEN_WIDTH + x);
+                putchar(pixel ? '#' : '.');
+                hash = (hash ^ pixel) * 0x100000001B3ULL;
+            }
+            putchar('\n');
+        }
+        long long cycles = (long long) movie.getFrameCount() * movie.getCyclesPerFrame();
+        printf("screen %016llx\n", (unsigned long long) hash);
+        std::cout << movie.getFrameCount() << " frames, " << cycles << " cycles in " << seconds << " s ("
+                  << cycles / seconds / 1e6 << " MIPS)" << std::endl;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+#include <cstring>
+#include "rewind.h"
+
+// Run lengths are stored in one byte below 0x80 and in two bytes (high bit set) otherwise,
+// which covers every run inside a Chip8State
+static inline unsigned char *writeCount(unsigned char *out, unsigned int count) {
+    if (count < 0x80) {
+        *out++ = count;
+    }
+    else {
+        *out++ = 0x80 | (count >> 8);
+        *out++ = count & 0xFF;
+    }
+    return out;
+}
+
+static inline const unsigned char *readCount(const unsigned char *in, unsigned int &count) {
+    count = *in++;
+    if (count & 0x80) {
+        count = (count & 0x7F) << 8 | *in++;
+    }
+    return in;
+}
+
+// XOR base for keyframes
+static const unsigned char zeroState[sizeof(Chip8State)] = {};
+
+Rewind::Rewind() : buffer(REWIND_BUFFER_SIZE), scratch(3 * sizeof(Chip8State)) {}
+
+unsigned int Rewind::encode(const Chip8State &state, const unsigned char *previous) {
+    const unsigned char *a = (const unsigned char *) &state;
+    const unsigned int n = sizeof(Chip8State);
+    unsigned char *out = scratch.data();
+
+    unsigned int i = 0;
+    while (i < n) {
+        // Skip unchanged bytes, a word at a time where possible
+        unsigned int start = i;
+        while (i + 8 <= n) {
+            uint64_t x, y;
+            memcpy(&x, a + i, 8);
+            memcpy(&y, previous + i, 8);
+            if (x != y) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < n && a[i] == previous[i]) {
+            i++;
+        }
+        if (i == n) {
+            break; // Trailing unchanged bytes need no pair
+        }
+        unsigned int zeros = i - start;
+
+        // Changed bytes; a single unchanged byte is cheaper to keep than to start a new pair
+        unsigned int literalStart = i;
+        while (i < n && (a[i] != previous[i] || (i + 1 < n && a[i + 1] != previous[i + 1]))) {
+            i++;
+        }
+
+        out = writeCount(out, zeros);
+        out = writeCount(out, i - literalStart);
+        for (unsigned int j = literalStart; j < i; j++) {
+            *out++ = a[j] ^ previous[j];
+        }
+    }
+    return (unsigned int) (out - scratch.data());
+}
+
+void Rewind::apply(const Frame &frame, Chip8State &state) {
+    unsigned char *s = (unsigned char *) &state;
+    const unsigned char *in = buffer.data() + frame.offset;
+    const unsigned char *end = in + frame.size;
+    unsigned int i = 0;
+    while (in < end) {
+        unsigned int zeros, literals;
+        in = readCount(in, zeros);
+        in = readCount(in, literals);
+        i += zeros;
+        for (unsigned int j = 0; j < literals; j++) {
+            s[i++] ^= *in++;
+        }
+    }
+}
+
+int Rewind::lastKeyframe(int frame) {
+    while (frame > 0 && !frames[frame].keyframe) {
+        frame--;
+    }
+    return frame;
+}
+
+void Rewind::evict(unsigned int start, unsigned int end) {
+    while (!frames.empty() && frames.front().offset < end && frames.front().offset + frames.front().size > start) {
+        bytesUsed -= frames.front().size;
+        frames.pop_front();
+        position--;
+    }
+}
+
+void Rewind::record(const Chip8State &state) {
+    // Recording after a rewind replaces the frames that were rewound over
+    while ((int) frames.size() > position + 1) {
+        bytesUsed -= frames.back().size;
+        frames.pop_back();
+    }
+    writeOffset = frames.empty() ? 0 : frames.back().offset + frames.back().size;
+
+    bool keyframe = frames.empty() || (int) frames.size() - lastKeyframe(frames.size() - 1) >= REWIND_KEYFRAME_INTERVAL;
+    unsigned int size = encode(state, keyframe ? zeroState : (const unsigned char *) &current);
+
+    while (true) {
+        if (writeOffset + size > buffer.size()) {
+            // Everything past the write position is older than what is at the start
+            evict(writeOffset, buffer.size());
+            writeOffset = 0;
+        }
+        evict(writeOffset, writeOffset + size);
+        // Frames before the first remaining keyframe can't be reconstructed any more
+        while (!frames.empty() && !frames.front().keyframe) {
+            bytesUsed -= frames.front().size;
+            frames.pop_front();
+            position--;
+        }
+        if (frames.empty() && !keyframe) {
+            // The previous frame is gone, so this one has to stand on its own
+            keyframe = true;
+            size = encode(state, zeroState);
+            continue;
+        }
+        break;
+    }
+
+    memcpy(buffer.data() + writeOffset, scratch.data(), size);
+    frames.push_back({ writeOffset, size, keyframe });
+    bytesUsed += size;
+    writeOffset += size;
+    current = state;
+    position = frames.size() - 1;
+}
+
+bool Rewind::seek(int frame, Chip8State &state) {
+    if (frame < 0 || frame >= (int) frames.size()) {
+        return false;
+    }
+
+    int keyframe = lastKeyframe(frame);
+    if (position >= keyframe && position <= frame) {
+        // Walk forward from the current frame
+    }
+    else if (position > frame && lastKeyframe(position) == keyframe && position - frame < frame - keyframe) {
+        // XOR deltas are their own inverse, so walk backward from the current frame
+        for (int i = position; i > frame; i--) {
+            apply(frames[i], current);
+        }
+        position = frame;
+    }
+    else {
+        memset((void *) &current, 0, sizeof(Chip8State));
+        apply(frames[keyframe], current);
+        position = keyframe;
+    }
+
+    for (int i = position + 1; i <= frame; i++) {
+        if (frames[i].keyframe) {
+            memset((void *) &current, 0, sizeof(Chip8State));
+        }
+        apply(frames[i], current);
+    }
+    position = frame;
+    state = current;
+    return true;
+}
+
+void Rewind::clear() {
+    frames.clear();
+    bytesUsed = 0;
+    writeOffset = 0;
+    position = -1;
+}
+
+int Rewind::getFrameCount() {
+    return frames.size();
+}
+
+int Rewind::getPosition() {
+    return position;
+}
+
+unsigned int Rewind::getBytesUsed() {
+    return bytesUsed;
+}
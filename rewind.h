@@ -0,0 +1,101 @@
+/*
+Rewind history for Chip 8 system; keeps one snapshot per emulated frame in a fixed-size ring
+buffer
+*/
+
+#ifndef REWIND_H_INCLUDED
+#define REWIND_H_INCLUDED
+
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024) // Bytes of encoded history; the oldest frames are dropped when full
+#define REWIND_KEYFRAME_INTERVAL 60 // Frames between full snapshots
+
+#include <deque>
+#include <vector>
+#include "chip8.h"
+
+class Rewind {
+private:
+    // Encoded snapshot in the ring buffer. A keyframe holds the whole state; any other frame
+    // holds the XOR of its state with the previous frame's, so frames can be reached by
+    // walking forward from a keyframe or backward from a later frame.
+    // Both are run-length encoded as pairs of (zero bytes to skip, literal bytes to XOR)
+    // followed by the literals, one byte per count
+    struct Frame {
+        unsigned int offset;
+        unsigned int size;
+        bool keyframe;
+    };
+
+    std::vector<unsigned char> buffer;
+    unsigned int writeOffset = 0;
+    // Oldest frame first; always starts with a keyframe
+    std::deque<Frame> frames;
+    // Sum of the sizes of frames, kept up to date as frames are added and dropped
+    unsigned int bytesUsed = 0;
+    // Frame the emulator is at and its decoded state
+    int position = -1;
+    Chip8State current;
+    // Scratch space for encoding; large enough for the worst case
+    std::vector<unsigned char> scratch;
+
+    /*
+    Run-length encodes the XOR of a state with the bytes of another into scratch
+    Returns the encoded size
+    */
+    unsigned int encode(const Chip8State &state, const unsigned char *previous);
+
+    /*
+    XORs an encoded frame into a state
+    */
+    void apply(const Frame &frame, Chip8State &state);
+
+    /*
+    Returns the index of the last keyframe at or before frame
+    */
+    int lastKeyframe(int frame);
+
+    /*
+    Drops the oldest frames while they overlap the range [start, end) of the buffer
+    */
+    void evict(unsigned int start, unsigned int end);
+
+public:
+    Rewind();
+
+    /*
+    Stores the state at the end of an emulated frame. Frames after the current position,
+    left over from rewinding, are discarded first
+    */
+    void record(const Chip8State &state);
+
+    /*
+    Moves to a recorded frame
+    Args:
+        - frame: Index of the frame, from 0 (oldest) to getFrameCount() - 1
+        - state: Set to the state at that frame
+    Returns false if no such frame is recorded
+    */
+    bool seek(int frame, Chip8State &state);
+
+    /*
+    Discards all history
+    */
+    void clear();
+
+    /*
+    Number of frames recorded
+    */
+    int getFrameCount();
+
+    /*
+    Index of the frame the emulator is at, or -1 if nothing is recorded
+    */
+    int getPosition();
+
+    /*
+    Bytes of the ring buffer currently holding frames
+    */
+    unsigned int getBytesUsed();
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include "rom_pack.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ROM_PACK_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define ROM_PACK_MMAP 0
+#endif
+
+// Start of a pack file, all in host byte order. It is followed by romCount entries sorted by
+// hash and then name, romCount 32-bit entry indices sorted by name, the names, and the ROMs,
+// each at a multiple of ROM_PACK_ALIGNMENT
+struct RomPack::Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t romCount;
+    uint32_t reserved;
+};
+
+struct RomPack::Entry {
+    uint64_t hash;
+    uint64_t offset; // Offsets are from the start of the file
+    uint32_t size;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+
+#if ROM_PACK_MMAP
+static void unmapFile(const unsigned char *base, size_t length) {
+    if (base) {
+        munmap((void *) base, length);
+    }
+}
+#endif
+
+RomPack::RomPack(std::string fileName) {
+#if ROM_PACK_MMAP
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw Chip8::InitializationError("Unable to open ROM pack");
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(Header)) {
+        close(fd);
+        throw Chip8::InitializationError("Not a ROM pack");
+    }
+    length = status.st_size;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw Chip8::InitializationError("Unable to map ROM pack");
+    }
+    base = (const unsigned char *) mapping;
+#else
+    std::ifstream fin(fileName, std::ios::binary | std::ios::ate);
+    if (!fin.is_open()) {
+        throw Chip8::InitializationError("Unable to open ROM pack");
+    }
+    contents.resize(fin.tellg());
+    fin.seekg(0);
+    if (!fin.read((char *) contents.data(), contents.size()) || contents.size() < sizeof(Header)) {
+        throw Chip8::InitializationError("Not a ROM pack");
+    }
+    base = contents.data();
+    length = contents.size();
+#endif
+
+    // Check everything a lookup relies on once here, so lookups never read outside the file
+    try {
+        const Header *header = (const Header *) base;
+        if (memcmp(header->magic, ROM_PACK_MAGIC, 4) != 0) {
+            throw Chip8::InitializationError("Not a ROM pack");
+        }
+        if (header->version != ROM_PACK_VERSION) {
+            throw Chip8::InitializationError("Unsupported ROM pack version");
+        }
+        size_t indexEnd = sizeof(Header) + (size_t) header->romCount * (sizeof(Entry) + sizeof(uint32_t));
+        if (header->romCount > length / sizeof(Entry) || indexEnd > length) {
+            throw Chip8::InitializationError("Truncated ROM pack");
+        }
+        romCount = header->romCount;
+        entries = (const Entry *) (base + sizeof(Header));
+        nameOrder = (const uint32_t *) (entries + romCount);
+
+        for (int i = 0; i < romCount; i++) {
+            const Entry &entry = entries[i];
+            if (entry.size > MAX_ROM_SIZE || entry.offset > length || entry.size > length - entry.offset ||
+                entry.nameOffset > length || entry.nameLength > length - entry.nameOffset ||
+                nameOrder[i] >= (uint32_t) romCount) {
+                throw Chip8::InitializationError("Corrupt ROM pack index");
+            }
+            if (i > 0 && (entries[i - 1].hash > entry.hash ||
+                          getRom(entries[nameOrder[i - 1]]).name >= getRom(entries[nameOrder[i]]).name)) {
+                throw Chip8::InitializationError("ROM pack index is not sorted");
+            }
+        }
+    } catch(...) {
+#if ROM_PACK_MMAP
+        unmapFile(base, length);
+#endif
+        throw;
+    }
+}
+
+RomPack::~RomPack() {
+#if ROM_PACK_MMAP
+    unmapFile(base, length);
+#endif
+}
+
+int RomPack::getRomCount() {
+    return romCount;
+}
+
+PackedRom RomPack::getRom(const Entry &entry) {
+    PackedRom rom;
+    rom.name = std::string_view((const char *) base + entry.nameOffset, entry.nameLength);
+    rom.data = base + entry.offset;
+    rom.size = entry.size;
+    rom.hash = entry.hash;
+    return rom;
+}
+
+PackedRom RomPack::getRom(int index) {
+    return getRom(entries[index]);
+}
+
+bool RomPack::findByName(std::string_view name, PackedRom &rom) {
+    const uint32_t *position = std::lower_bound(nameOrder, nameOrder + romCount, name,
+        [this](uint32_t entry, std::string_view name) { return getRom(entries[entry]).name < name; });
+    if (position == nameOrder + romCount || getRom(entries[*position]).name != name) {
+        return false;
+    }
+    rom = getRom(entries[*position]);
+    return true;
+}
+
+bool RomPack::findByHash(uint64_t hash, PackedRom &rom) {
+    const Entry *position = std::lower_bound(entries, entries + romCount, hash,
+        [](const Entry &entry, uint64_t hash) { return entry.hash < hash; });
+    if (position == entries + romCount || position->hash != hash) {
+        return false;
+    }
+    rom = getRom(*position);
+    return true;
+}
+
+bool RomPack::find(std::string_view key, PackedRom &rom) {
+    if (findByName(key, rom)) {
+        return true;
+    }
+    if (key.size() != 16 || key.find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos) {
+        return false;
+    }
+    return findByHash(strtoull(std::string(key).c_str(), nullptr, 16), rom);
+}
+
+void RomPack::write(std::string fileName, const std::vector<std::string> &names,
+                    const std::vector<std::vector<unsigned char>> &roms) {
+    std::vector<uint32_t> byName(names.size());
+    std::iota(byName.begin(), byName.end(), 0);
+    std::sort(byName.begin(), byName.end(), [&](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+    for (size_t i = 1; i < byName.size(); i++) {
+        if (names[byName[i - 1]] == names[byName[i]]) {
+            throw std::invalid_argument("Duplicate ROM name " + names[byName[i]]);
+        }
+    }
+
+    // Entries in hash order; ties go by name, so findByHash() picks the first name
+    std::vector<uint64_t> hashes(roms.size());
+    for (size_t i = 0; i < roms.size(); i++) {
+        if (roms[i].size() > MAX_ROM_SIZE) {
+            throw std::invalid_argument("ROM " + names[i] + " is larger than " + std::to_string(MAX_ROM_SIZE) + " bytes");
+        }
+        hashes[i] = Chip8::hashRom(roms[i].data(), roms[i].size());
+    }
+    std::vector<uint32_t> byHash = byName;
+    std::stable_sort(byHash.begin(), byHash.end(), [&](uint32_t a, uint32_t b) { return hashes[a] < hashes[b]; });
+
+    // Lay out the index, the names and then the page-aligned ROMs
+    size_t nameStart = sizeof(Header) + roms.size() * (sizeof(Entry) + sizeof(uint32_t));
+    std::vector<Entry> entries(roms.size());
+    std::vector<uint32_t> entryOf(roms.size()); // Position in entries of each ROM
+    std::string nameTable;
+    for (size_t i = 0; i < byHash.size(); i++) {
+        entryOf[byHash[i]] = i;
+    }
+    for (size_t i = 0; i < roms.size(); i++) {
+        Entry &entry = entries[entryOf[i]];
+        entry.hash = hashes[i];
+        entry.size = roms[i].size();
+        entry.nameOffset = nameStart + nameTable.size();
+        entry.nameLength = names[i].size();
+        entry.reserved = 0;
+        nameTable += names[i];
+    }
+    uint64_t offset = nameStart + nameTable.size();
+    for (Entry &entry : entries) {
+        offset = (offset + ROM_PACK_ALIGNMENT - 1) / ROM_PACK_ALIGNMENT * ROM_PACK_ALIGNMENT;
+        entry.offset = offset;
+        offset += entry.size;
+    }
+    std::vector<uint32_t> nameOrder(roms.size());
+    for (size_t i = 0; i < byName.size(); i++) {
+        nameOrder[i] = entryOf[byName[i]];
+    }
+
+    std::ofstream fout(fileName, std::ios::binary);
+    if (!fout.is_open()) {
+        throw Chip8::InitializationError("Unable to open ROM pack");
+    }
+    Header header;
+    memcpy(header.magic, ROM_PACK_MAGIC, 4);
+    header.version = ROM_PACK_VERSION;
+    header.romCount = roms.size();
+    header.reserved = 0;
+    fout.write((const char *) &header, sizeof(header));
+    fout.write((const char *) entries.data(), entries.size() * sizeof(Entry));
+    fout.write((const char *) nameOrder.data(), nameOrder.size() * sizeof(uint32_t));
+    fout.write(nameTable.data(), nameTable.size());
+    uint64_t written = nameStart + nameTable.size();
+    for (size_t i = 0; i < byHash.size(); i++) {
+        const std::vector<unsigned char> &rom = roms[byHash[i]];
+        std::string padding(entries[i].offset - written, '\0');
+        fout.write(padding.data(), padding.size());
+        fout.write((const char *) rom.data(), rom.size());
+        written = entries[i].offset + rom.size();
+    }
+    if (!fout) {
+        throw Chip8::InitializationError("Unable to write ROM pack");
+    }
+}
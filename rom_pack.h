@@ -0,0 +1,92 @@
+/*
+ROM packs for Chip 8 system; a whole corpus of ROMs in one file that is memory-mapped and
+looked up by name or hash, so a run over thousands of ROMs opens a single file
+*/
+
+#ifndef ROM_PACK_H_INCLUDED
+#define ROM_PACK_H_INCLUDED
+
+#define ROM_PACK_MAGIC "C8PK"
+#define ROM_PACK_VERSION 1
+#define ROM_PACK_ALIGNMENT 4096 // Every ROM starts on its own page of the pack
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "chip8.h"
+
+// A ROM inside a pack; data and name point into the mapped file and are valid as long as
+// the pack is open
+struct PackedRom {
+    std::string_view name;
+    const unsigned char *data;
+    size_t size;
+    uint64_t hash; // As returned by Chip8::hashRom()
+};
+
+class RomPack {
+private:
+    struct Header;
+    struct Entry;
+
+    // The mapped file, or a copy of it where memory mapping isn't available
+    const unsigned char *base = nullptr;
+    size_t length = 0;
+    std::vector<unsigned char> contents;
+
+    // Entries sorted by hash, and the indices of the entries sorted by name
+    const Entry *entries = nullptr;
+    const uint32_t *nameOrder = nullptr;
+    int romCount = 0;
+
+    PackedRom getRom(const Entry &entry);
+
+public:
+    /*
+    Maps a pack file and checks that its index is consistent
+    */
+    RomPack(std::string fileName);
+    ~RomPack();
+
+    RomPack(const RomPack &) = delete;
+    RomPack &operator=(const RomPack &) = delete;
+
+    int getRomCount();
+
+    /*
+    Returns a ROM by its position in the index, which is sorted by hash
+    */
+    PackedRom getRom(int index);
+
+    /*
+    Looks up a ROM by its name in the pack, i.e. its path relative to the packed directory
+    Returns false if there is no such ROM
+    */
+    bool findByName(std::string_view name, PackedRom &rom);
+
+    /*
+    Looks up a ROM by the hash of its contents; if several ROMs have the same contents,
+    returns the one whose name sorts first
+    Returns false if there is no such ROM
+    */
+    bool findByHash(uint64_t hash, PackedRom &rom);
+
+    /*
+    Looks up a ROM by name or, failing that, by a hash written as 16 hexadecimal digits
+    Returns false if neither matches
+    */
+    bool find(std::string_view key, PackedRom &rom);
+
+    /*
+    Writes a pack file
+    Args:
+        - fileName: File to write
+        - names: Name of each ROM; must be unique
+        - roms: Contents of each ROM, at most MAX_ROM_SIZE bytes
+    */
+    static void write(std::string fileName, const std::vector<std::string> &names,
+                      const std::vector<std::vector<unsigned char>> &roms);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include <chrono>
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+    lastFrameTime = std::chrono::steady_clock::now();
+    frameTime = lastFrameTime;
+}
+
+void Scheduler::beginFrame(float clockSpeed) {
+    lastFrameTime = frameTime;
+    frameTime = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(frameTime - lastFrameTime).count();
+
+    pendingCycles += dt * clockSpeed;
+
+    // Cap the batch so a long stall (window drag, debugger break) doesn't freeze the GUI
+    // while the emulator catches up; the rest of the backlog is dropped
+    if (pendingCycles > MAX_CATCHUP_CYCLES) {
+        pendingCycles = MAX_CATCHUP_CYCLES;
+    }
+
+    cyclesDue = (int) pendingCycles;
+    pendingCycles -= cyclesDue;
+}
+
+void Scheduler::reset() {
+    lastFrameTime = std::chrono::steady_clock::now();
+    frameTime = lastFrameTime;
+    pendingCycles = 0;
+    cyclesDue = 0;
+}
+
+int Scheduler::getCyclesDue() {
+    return cyclesDue;
+}
+
+
+int Scheduler::getCycleAt(std::chrono::steady_clock::time_point time) {
+    if (time > frameTime) {
+        return -1;
+    }
+    if (time <= lastFrameTime) {
+        return 0;
+    }
+    double fraction = std::chrono::duration<double>(time - lastFrameTime).count() /
+                      std::chrono::duration<double>(frameTime - lastFrameTime).count();
+    return (int) (fraction * cyclesDue);
+}
@@ -0,0 +1,55 @@
+/*
+Scheduler for Chip 8 system; decides how much emulation work is due each frame
+*/
+
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#define MAX_CATCHUP_CYCLES 10000 // Most cycles run in one batch; larger backlogs are dropped
+
+#include <chrono>
+
+class Scheduler {
+private:
+    // Host time covered by the current frame's batch, from the previous frame to this one
+    std::chrono::steady_clock::time_point lastFrameTime;
+    std::chrono::steady_clock::time_point frameTime;
+    // Fractional cycles carried over between frames so that the effective rate matches the
+    // configured clock speed exactly
+    double pendingCycles = 0;
+    // Cycles due for the current frame, set by beginFrame(); the timers follow from them
+    // through Chip8::runTimed()
+    int cyclesDue = 0;
+
+public:
+    Scheduler();
+
+    /*
+    Measures the time elapsed since the previous frame and computes how many cycles are
+    due for this one
+    Args:
+        - clockSpeed: Clock speed of the CHIP-8 in Hertz
+    */
+    void beginFrame(float clockSpeed);
+
+    /*
+    Discards any elapsed time, e.g. while the CHIP-8 is paused, so that resuming
+    does not try to catch up on it
+    */
+    void reset();
+
+    /*
+    Number of emulation cycles due for this frame
+    */
+    int getCyclesDue();
+
+    /*
+    Maps a host time onto the cycles due for this frame, as if they had run evenly spread
+    over the time since the previous frame
+    Returns the cycle at which something that happened at that time takes effect, 0 for
+    times before the frame, or -1 for times after it, which belong to a later frame
+    */
+    int getCycleAt(std::chrono::steady_clock::time_point time);
+};
+
+#endif
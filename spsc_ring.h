@@ -0,0 +1,56 @@
+/*
+Lock-free ring buffer for passing values from one producer thread to one consumer thread
+*/
+
+#ifndef SPSC_RING_H_INCLUDED
+#define SPSC_RING_H_INCLUDED
+
+#include <atomic>
+
+template <typename T, unsigned int CAPACITY>
+class SpscRing {
+private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+    T items[CAPACITY];
+    // Free-running counts of items read and written; they wrap, and only their difference
+    // and their low bits are used
+    alignas(64) std::atomic<unsigned int> head{0};
+    alignas(64) std::atomic<unsigned int> tail{0};
+
+public:
+    /*
+    Appends an item; called by the producer only. Returns false if the ring is full
+    */
+    bool push(const T &item) {
+        unsigned int position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        items[position & (CAPACITY - 1)] = item;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+    Copies the oldest item without removing it; called by the consumer only. Returns false
+    if the ring is empty
+    */
+    bool peek(T &item) {
+        unsigned int position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[position & (CAPACITY - 1)];
+        return true;
+    }
+
+    /*
+    Removes the oldest item; called by the consumer only, after a successful peek()
+    */
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+#endif
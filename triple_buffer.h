@@ -0,0 +1,52 @@
+/*
+Lock-free triple buffer for handing values from one writer thread to one reader thread; the
+writer never waits for the reader and the reader always sees the latest complete value
+*/
+
+#ifndef TRIPLE_BUFFER_H_INCLUDED
+#define TRIPLE_BUFFER_H_INCLUDED
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+private:
+    static const unsigned char INDEX_MASK = 0x3;
+    static const unsigned char FRESH = 0x4; // Set in shared when it holds a value the reader hasn't taken
+
+    T buffers[3];
+    // The writer owns buffers[back] and the reader buffers[front]; the third buffer is
+    // swapped between them through shared
+    alignas(64) std::atomic<unsigned char> shared{1};
+    alignas(64) unsigned char back = 0;
+    alignas(64) unsigned char front = 2;
+
+public:
+    /*
+    Returns the buffer the writer fills next; it holds stale contents, so every field has
+    to be written before publish()
+    */
+    T &getBack() {
+        return buffers[back];
+    }
+
+    /*
+    Makes the back buffer the latest value; called by the writer only
+    */
+    void publish() {
+        back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /*
+    Returns the latest published value, or the one returned last time if nothing new has
+    been published; called by the reader only. The reference stays valid until the next call
+    */
+    const T &read() {
+        if (shared.load(std::memory_order_relaxed) & FRESH) {
+            front = shared.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+        return buffers[front];
+    }
+};
+
+#endif